@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+#include <bfdev/macro.h>
+#include <bfrl/core.h>
+
+#define BENCH_ROUNDS 20000
+#define BENCH_CHUNK 64
+
+/* Typing, motions and edits, every entry is one key */
+static const char *
+bench_keys[] = {
+    "g", "i", "t", " ", "c", "o", "m", "m", "i", "t", " ", "-", "m", " ",
+    "\"", "f", "i", "x", " ", "t", "h", "e", " ", "b", "u", "g", "\"",
+    "\x1b[D", "\x1b[D", "\x1b[1;5D", "\x1b[1;5D", "\x1b[C",
+    "\xe4\xbd\xa0", "\xe5\xa5\xbd", "\x7f", "\x7f",
+    "\x1b""b", "\x1b""d", "\x01", "\x1b[F", "\x1b\x7f", "\r",
+    "\x10", "\x10", "\x0e", "\x10", "\x01", "\x0b",
+    "l", "s", " ", "-", "l", "\r",
+};
+
+static double
+bench_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long rounds = BENCH_ROUNDS, index, keys, lines, render;
+    unsigned int len, walk, step, count;
+    struct bfrl_delta delta;
+    struct bfrl_core *core;
+    double start, elapsed;
+    char *input;
+
+    if (argc > 1)
+        rounds = strtoul(argv[1], NULL, 0);
+
+    for (len = count = 0; count < BFDEV_ARRAY_SIZE(bench_keys); ++count)
+        len += strlen(bench_keys[count]);
+
+    input = malloc(len);
+    if (!input)
+        err(ENOMEM, "malloc");
+
+    for (walk = count = 0; count < BFDEV_ARRAY_SIZE(bench_keys); ++count) {
+        memcpy(input + walk, bench_keys[count], strlen(bench_keys[count]));
+        walk += strlen(bench_keys[count]);
+    }
+
+    core = bfrl_core_create(NULL, 80, 24);
+    if (!core)
+        err(ENOMEM, "bfrl_core_create");
+
+    if (bfrl_core_start(core, "# ", "> ", &delta))
+        err(ENOMEM, "bfrl_core_start");
+
+    keys = lines = render = 0;
+    start = bench_clock();
+
+    for (index = 0; index < rounds; ++index) {
+        for (walk = 0; walk < len; walk += delta.used) {
+            step = len - walk < BENCH_CHUNK ? len - walk : BENCH_CHUNK;
+            if (bfrl_core_feed(core, input + walk, step, &delta))
+                err(ENOMEM, "bfrl_core_feed");
+
+            render += delta.rlen;
+            if (delta.events & BFRL_EVENT_LINE)
+                ++lines;
+        }
+        keys += BFDEV_ARRAY_SIZE(bench_keys);
+    }
+
+    elapsed = bench_clock() - start;
+    printf("keys: %lu, lines: %lu, input: %lu bytes, render: %lu bytes\n",
+           keys, lines, rounds * len, render);
+    printf("time: %.3fs, %.2fM keys/s, %.1fns per key\n",
+           elapsed, keys / elapsed / 1e6, elapsed * 1e9 / keys);
+
+    bfrl_core_destroy(core);
+    free(input);
+
+    return 0;
+}
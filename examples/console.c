@@ -4,12 +4,106 @@
 #include <errno.h>
 #include <err.h>
 #include <termios.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <bfrl/readline.h>
 
+static volatile sig_atomic_t console_winch;
+
+enum console_token {
+    CONSOLE_COMMAND = 0,
+    CONSOLE_ARGUMENT,
+};
+
+static const char *
+console_commands[] = {
+    "echo", "exit", "help", NULL,
+};
+
+static unsigned int
+console_highlight(const char *buff, unsigned int len, unsigned int offset,
+                  unsigned int *tstate, const char **style, void *data)
+{
+    const char **cmd;
+    unsigned int end;
+
+    end = offset;
+    if (buff[offset] == ' ' || buff[offset] == '\\' || buff[offset] == '\n') {
+        while (end < len && (buff[end] == ' ' || buff[end] == '\\' || buff[end] == '\n'))
+            ++end;
+        return end - offset;
+    }
+
+    if (buff[offset] == '"' || buff[offset] == '\'') {
+        while (++end < len && buff[end] != buff[offset]);
+        *style = "33";
+        return end - offset + 1;
+    }
+
+    while (end < len && buff[end] != ' ' && buff[end] != '\\' && buff[end] != '\n')
+        ++end;
+
+    if (*tstate == CONSOLE_COMMAND) {
+        *tstate = CONSOLE_ARGUMENT;
+        *style = "1;31";
+        for (cmd = console_commands; *cmd; ++cmd) {
+            if (strlen(*cmd) == end - offset && !strncmp(*cmd, buff + offset, end - offset)) {
+                *style = "1;32";
+                break;
+            }
+        }
+    }
+
+    return end - offset;
+}
+
+static void
+console_resize(struct bfrl_state *rstate)
+{
+    struct winsize size;
+
+    if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &size))
+        bfrl_resize(rstate, size.ws_col, size.ws_row);
+}
+
+static void
+console_signal(int signo)
+{
+    console_winch = 1;
+}
+
 static unsigned int
 console_read(char *str, unsigned int len, void *data)
 {
-    return read(STDIN_FILENO, str, len);
+    ssize_t retval;
+
+    for (;;) {
+        retval = read(STDIN_FILENO, str, len);
+        if (retval >= 0)
+            return retval;
+
+        if (errno != EINTR)
+            return 0;
+
+        if (console_winch) {
+            console_winch = 0;
+            console_resize(*(struct bfrl_state **)data);
+        }
+    }
+}
+
+static bool
+console_poll(unsigned int timeout, void *data)
+{
+    struct pollfd pfd;
+
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+
+    /* Interrupted waits count as input so the read picks it up */
+    return poll(&pfd, 1, timeout) != 0;
 }
 
 static void
@@ -18,8 +112,15 @@ console_write(const char *str, unsigned int len, void *data)
     write(STDOUT_FILENO, str, len);
 }
 
+static void
+console_writev(const struct bfrl_iovec *iov, unsigned int count, void *data)
+{
+    writev(STDOUT_FILENO, (const struct iovec *)iov, count);
+}
+
 int main(void)
 {
+    struct sigaction action = {};
     struct termios term, save;
     struct bfrl_state *rstate;
     int retval;
@@ -35,10 +136,20 @@ int main(void)
     if (retval)
         err(retval, "tcsetattr");
 
-    rstate = bfrl_alloc(NULL, console_read, console_write, NULL);
+    rstate = bfrl_alloc(NULL, console_read, console_write, &rstate);
     if (!rstate)
         err(-ENOMEM, "bfrl_alloc");
 
+    action.sa_handler = console_signal;
+    sigaction(SIGWINCH, &action, NULL);
+    console_resize(rstate);
+
+    bfrl_highlight_set(rstate, console_highlight, NULL);
+    bfrl_poll_set(rstate, console_poll, 0);
+    bfrl_writev_set(rstate, console_writev);
+    bfrl_wordchars_set(rstate, "_-./");
+    bfrl_recall_set(rstate, BFRL_RECALL_FRECENT);
+
     for (;;) {
         const char *line;
 
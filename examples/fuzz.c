@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <bfdev/macro.h>
+#include <bfrl/core.h>
+#include "screen.h"
+
+#define FUZZ_EXPIRE 0xff
+#define FUZZ_RESIZE 0xfe
+#define FUZZ_ROUNDS 20000
+#define FUZZ_LENGTH 512
+#define FUZZ_PROMPT "\x1b[1m#\x1b[0m "
+#define FUZZ_CPROMPT "> "
+
+static struct screen fuzz_screen;
+static bool fuzz_blind;
+
+static unsigned int
+fuzz_highlight(const char *buff, unsigned int len, unsigned int offset,
+               unsigned int *tstate, const char **style, void *data)
+{
+    unsigned int end;
+
+    /* Alternate between runs of letters and anything else */
+    for (end = offset + 1; end < len; ++end) {
+        if (!!((buff[end] | 0x20) >= 'a' && (buff[end] | 0x20) <= 'z') !=
+            !!((buff[offset] | 0x20) >= 'a' && (buff[offset] | 0x20) <= 'z'))
+            break;
+    }
+
+    *style = (*tstate ^= 1) ? "1;32" : NULL;
+    return end - offset;
+}
+
+static void
+fuzz_check(struct bfrl_core *core, const struct bfrl_delta *delta,
+           unsigned int fed)
+{
+    struct bfrl_state *state = core->state;
+    unsigned int index;
+
+    if (delta->used > fed || delta->rlen != core->rlen)
+        abort();
+
+    if (state->len >= state->bsize)
+        abort();
+
+#ifdef BFRL_CLIPBRD
+    if (state->clippos > state->len)
+        abort();
+#endif
+
+    /*
+     * Too narrow a terminal wraps differently, and a size reported
+     * in the input changes the width halfway through the output.
+     */
+    if (state->cols < 3 || state->cols != fuzz_screen.cols)
+        fuzz_blind = true;
+    if (!fuzz_blind)
+        screen_write(&fuzz_screen, delta->render, delta->rlen);
+
+    /* The layout of an accepted line is stale until the next one */
+    if (!state->active)
+        return;
+
+    if (state->pos > state->len || !state->nlines || state->nlines > state->lsize ||
+        state->lines[0].offset)
+        abort();
+
+    for (index = 1; index < state->nlines; ++index) {
+        if (state->lines[index].offset < state->lines[index - 1].offset ||
+            state->lines[index].offset > state->len)
+            abort();
+    }
+
+    for (index = 0; index < state->nspans; ++index) {
+        if (state->spans[index].offset > state->len)
+            abort();
+    }
+
+    /* What the terminal shows must be what a repaint would draw */
+    if (!fuzz_blind && screen_check(&fuzz_screen, state, FUZZ_PROMPT,
+                                    FUZZ_CPROMPT) >= 0)
+        abort();
+}
+
+/*
+ * The first byte picks the width, the second the options. 0xff in
+ * the input stands for a read timeout and 0xfe plus a byte a resize.
+ */
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct bfrl_delta delta;
+    struct bfrl_core *core;
+    size_t walk, end;
+
+    if (size < 2)
+        return 0;
+
+    core = bfrl_core_create(NULL, data[0] % 100, 24);
+    if (!core)
+        return 0;
+
+    if (data[1] & 1)
+        bfrl_highlight_set(core->state, fuzz_highlight, NULL);
+    if (data[1] & 2)
+        bfrl_wordchars_set(core->state, "_-./");
+    if (data[1] & 4)
+        bfrl_recall_set(core->state, BFRL_RECALL_FRECENT);
+
+    screen_reset(&fuzz_screen, data[0] % 100);
+    fuzz_blind = false;
+
+    bfrl_core_start(core, FUZZ_PROMPT, FUZZ_CPROMPT, &delta);
+    fuzz_check(core, &delta, 0);
+
+    for (walk = 2; walk < size;) {
+        if (data[walk] == FUZZ_EXPIRE) {
+            bfrl_core_expire(core, &delta);
+            fuzz_check(core, &delta, 0);
+            ++walk;
+            continue;
+        }
+
+        if (data[walk] == FUZZ_RESIZE) {
+            if (walk + 1 == size)
+                break;
+            if (!fuzz_blind && data[walk + 1] % 100 >= 3)
+                screen_resize(&fuzz_screen, data[walk + 1] % 100);
+            bfrl_core_resize(core, data[walk + 1] % 100, 24, &delta);
+            fuzz_check(core, &delta, 0);
+            walk += 2;
+            continue;
+        }
+
+        for (end = walk; end < size && data[end] < FUZZ_RESIZE; ++end);
+        bfrl_core_feed(core, (const char *)data + walk, end - walk, &delta);
+        fuzz_check(core, &delta, end - walk);
+        walk += delta.used;
+    }
+
+    bfrl_core_destroy(core);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+/* Escape sequence heavy bytes for builds without libFuzzer */
+static const char
+fuzz_alphabet[] = "\x1b\x1b\x1b[[[O;;0123456789ABCDFHPQRSu~abdlrwx \\\r\n"
+                  "\x01\x02\x03\x04\x05\x06\x08\x0b\x0c\x0e\x0f\x10\x11\x12"
+                  "\x13\x14\x15\x16\x17\x18\x19\x1a\x7f\xc3\xa9\xe4\xbd\xa0"
+                  "\xf0\x9f\x98\x80\xcc\x81\xfe\xff";
+
+/* Whole keys on a narrow terminal, for lines that wrap a lot */
+static const char *const
+fuzz_keys[] = {
+    "a", "b", " ", "\\", "\xc3\xa9", "\xe4\xbd\xa0", "\xf0\x9f\x98\x80",
+    "\x01", "\x02", "\x04", "\x05", "\x06", "\x0b", "\x7f", "\x1b""d",
+    "\x1b\x7f", "\x1b[3~", "\x1b[1;5D", "\x1b[1;5C", "\x10", "\r",
+};
+
+static uint32_t fuzz_seed = 1;
+
+static uint32_t
+fuzz_random(void)
+{
+    fuzz_seed ^= fuzz_seed << 13;
+    fuzz_seed ^= fuzz_seed >> 17;
+    fuzz_seed ^= fuzz_seed << 5;
+    return fuzz_seed;
+}
+
+static void
+fuzz_file(const char *path)
+{
+    uint8_t *data;
+    long size;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    data = malloc(size + 1);
+    if (!data || fread(data, 1, size, file) != (size_t)size)
+        exit(1);
+
+    LLVMFuzzerTestOneInput(data, size);
+    fclose(file);
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t data[FUZZ_LENGTH];
+    unsigned int round, len, index;
+    const char *key;
+
+    if (argc > 1) {
+        for (index = 1; index < (unsigned int)argc; ++index)
+            fuzz_file(argv[index]);
+        return 0;
+    }
+
+    for (round = 0; round < FUZZ_ROUNDS; ++round) {
+        if (round & 1) {
+            data[0] = 3 + fuzz_random() % 8;
+            data[1] = fuzz_random();
+            for (len = 2; len + 8 < FUZZ_LENGTH;) {
+                key = fuzz_keys[fuzz_random() % BFDEV_ARRAY_SIZE(fuzz_keys)];
+                memcpy(data + len, key, strlen(key));
+                len += strlen(key);
+                if (fuzz_random() % 64 == 0)
+                    break;
+            }
+            LLVMFuzzerTestOneInput(data, len);
+            continue;
+        }
+
+        len = fuzz_random() % FUZZ_LENGTH;
+        for (index = 0; index < len; ++index) {
+            if (index < 2 || fuzz_random() % 8 == 0)
+                data[index] = fuzz_random();
+            else
+                data[index] = fuzz_alphabet[fuzz_random() % (sizeof(fuzz_alphabet) - 1)];
+        }
+        LLVMFuzzerTestOneInput(data, len);
+    }
+
+    printf("%u inputs\n", FUZZ_ROUNDS);
+    return 0;
+}
+
+#endif /* FUZZ_STANDALONE */
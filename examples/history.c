@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <bfdev/macro.h>
+#include <bfrl/readline.h>
+
+#define HISTORY_STEP 1000
+#define HISTORY_CYCLE 50
+#define HISTORY_RESCALE 20000
+
+static uint64_t history_now;
+static int history_failed;
+
+/* Time only moves when a test says so */
+static uint64_t
+history_clock(void *data)
+{
+    return history_now;
+}
+
+static void
+history_write(const char *str, unsigned int len, void *data)
+{
+}
+
+static void
+history_fail(const char *what, const char *want, const char *got)
+{
+    printf("%s: want '%s', got '%s'\n", what, want, got ? got : "(null)");
+    ++history_failed;
+}
+
+static struct bfrl_state *
+history_alloc(enum bfrl_recall recall)
+{
+    struct bfrl_state *state;
+
+    state = bfrl_alloc(NULL, NULL, history_write, NULL);
+    if (!state)
+        err(ENOMEM, "bfrl_alloc");
+
+    history_now = 0;
+    bfrl_history_clock_set(state, history_clock, NULL);
+    bfrl_recall_set(state, recall);
+
+    return state;
+}
+
+/* Type @input as one line, which ends up in the history itself */
+static const char *
+history_line(struct bfrl_state *state, const char *input)
+{
+    unsigned int len, used;
+    const char *line;
+
+    history_now += HISTORY_STEP;
+    len = strlen(input);
+    bfrl_start(state, "$ ", "> ");
+
+    for (line = NULL; len && !line; len -= used) {
+        line = bfrl_feed(state, input, len, &used);
+        input += used;
+    }
+
+    return line;
+}
+
+static void
+history_add(struct bfrl_state *state, const char *cmd, unsigned int times)
+{
+    while (times--) {
+        history_now += HISTORY_STEP;
+        if (bfrl_history_add(state, cmd, strlen(cmd)))
+            err(ENOMEM, "bfrl_history_add");
+    }
+}
+
+static void
+history_expect(const char *what, const char *want, const char *got)
+{
+    if (!got || strcmp(want, got))
+        history_fail(what, want, got);
+}
+
+static void
+history_suggest(struct bfrl_state *state, const char *str, const char *want)
+{
+    const struct bfrl_history *history;
+    char got[64];
+
+    history = bfrl_history_suggest(state, str, strlen(str));
+    if (!history) {
+        if (want)
+            history_fail("suggest", want, NULL);
+        return;
+    }
+
+    snprintf(got, sizeof(got), "%.*s", history->len, history->cmd);
+    if (!want || strcmp(want, got))
+        history_fail("suggest", want ? want : "(null)", got);
+}
+
+/* Recent order keeps every copy of a line, the ranking only the newest */
+static void
+history_recent(void)
+{
+    struct bfrl_history *history;
+    struct bfrl_state *state;
+    unsigned int count;
+
+    state = history_alloc(BFRL_RECALL_RECENT);
+    history_add(state, "a", 1);
+    history_add(state, "b", 1);
+    history_add(state, "a", 1);
+
+    count = 0;
+    bfdev_list_for_each_entry(history, &state->hrank, rank)
+        ++count;
+    if (count != 2)
+        history_fail("ranked copies", "2", count > 2 ? "more" : "less");
+
+    history_expect("recent ^P^P^P", "a", history_line(state, "\x10\x10\x10\r"));
+    history_expect("recent ^P^P^P^N", "b", history_line(state, "\x10\x10\x10\x0e\r"));
+
+    history = bfdev_list_first_entry(&state->history, struct bfrl_history, list);
+    if (history->stamp != history_now)
+        history_fail("stamp", "the time of the last line", "an older time");
+
+    bfrl_free(state);
+}
+
+/* Uses outweigh recency, until enough lines have gone by */
+static void
+history_frecent(void)
+{
+    struct bfrl_state *state;
+    char buff[32];
+    unsigned int index;
+
+    static const char *order[] = {
+        "make all", "ls", "make clean",
+    };
+
+    for (index = 0; index < BFDEV_ARRAY_SIZE(order); ++index) {
+        state = history_alloc(BFRL_RECALL_FRECENT);
+        history_add(state, "make all", 20);
+        history_add(state, "make clean", 1);
+        history_add(state, "ls", 1);
+
+        snprintf(buff, sizeof(buff), "%.*s\r", index + 1, "\x10\x10\x10");
+        history_expect("frecent ^P", order[index], history_line(state, buff));
+        bfrl_free(state);
+    }
+
+    state = history_alloc(BFRL_RECALL_FRECENT);
+    history_add(state, "old", 3);
+    for (index = 0; index < HISTORY_STEP; ++index) {
+        snprintf(buff, sizeof(buff), "cmd %u", index);
+        history_add(state, buff, 1);
+    }
+    history_add(state, "new", 2);
+    history_expect("decayed ^P", "new", history_line(state, "\x10\r"));
+
+    /* The best ranked match, not the latest one */
+    history_add(state, "git stash", 3);
+    history_add(state, "git status", 1);
+    history_suggest(state, "git st", "git stash");
+    history_suggest(state, "git statu", "git status");
+    history_suggest(state, "git stash", NULL);
+    history_suggest(state, "x", NULL);
+
+    bfrl_free(state);
+}
+
+static bool
+history_is(const struct bfrl_history *history, const char *cmd)
+{
+    return history->len == strlen(cmd) && !memcmp(history->cmd, cmd, history->len);
+}
+
+/* Scaling every weight down must not reorder the ranking */
+static void
+history_rescale(void)
+{
+    struct bfrl_history *history, *snap[HISTORY_CYCLE];
+    uint64_t weight[HISTORY_CYCLE], hinc, used, step;
+    unsigned int index, count, times, left, above;
+    struct bfrl_state *state;
+    char buff[32];
+
+    state = history_alloc(BFRL_RECALL_FRECENT);
+    for (index = 0; index < HISTORY_RESCALE; ++index) {
+        snprintf(buff, sizeof(buff), "cmd %u", index % HISTORY_CYCLE);
+
+        /* Everything but the line about to be used keeps its place */
+        count = 0;
+        used = 0;
+        bfdev_list_for_each_entry(history, &state->hrank, rank) {
+            if (history_is(history, buff))
+                used = history->weight;
+            else {
+                weight[count] = history->weight;
+                snap[count++] = history;
+            }
+        }
+
+        /* Its weight if nothing was ever scaled down */
+        times = 1 + index % 3;
+        for (hinc = step = state->hinc, left = times; step && left--;) {
+            step += step / BFRL_HISTORY_DECAY;
+            used += step;
+        }
+
+        history_add(state, buff, times);
+        if (state->hinc < hinc)
+            break;
+    }
+
+    if (index == HISTORY_RESCALE) {
+        history_fail("rescale", "a smaller increment", "none");
+        bfrl_free(state);
+        return;
+    }
+
+    printf("rescale: after %u rounds, %u ranked\n", index + 1, count + 1);
+
+    /* And the used line goes below the ones that would outweigh it */
+    for (index = above = 0; index < count; ++index)
+        above += weight[index] > used;
+
+    index = 0;
+    bfdev_list_for_each_entry(history, &state->hrank, rank) {
+        if (history_is(history, buff)) {
+            if (index != above)
+                history_fail("rescale", "the used line in place", "moved");
+            continue;
+        }
+        if (index >= count || snap[index++] != history) {
+            history_fail("rescale", "the same order", "a different one");
+            break;
+        }
+    }
+
+    bfrl_free(state);
+}
+
+int main(int argc, char *argv[])
+{
+    history_recent();
+    history_frecent();
+    history_rescale();
+
+    printf("%d failed\n", history_failed);
+    return !!history_failed;
+}
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <bfdev/macro.h>
+
+#define LOADGEN_PATH "/tmp/bfrl.sock"
+#define LOADGEN_SESSIONS 1000
+#define LOADGEN_SECONDS 5
+#define LOADGEN_EVENTS 256
+#define LOADGEN_BUCKETS 1000000
+#define LOADGEN_RESOLUTION 1000
+#define LOADGEN_STALL 1000000000ULL
+#define LOADGEN_BACKLOG 256
+#define LOADGEN_SYNC "echo loadgen-sync\r"
+#define LOADGEN_MARK "loadgen-sync\n# "
+
+struct loadgen_step {
+    const char *str;
+    bool typed;
+};
+
+struct client {
+    int fd;
+    unsigned int step;
+    unsigned int offset;
+    uint64_t sent;
+    bool started;
+    bool busy;
+    bool slow;
+
+    char tail[sizeof(LOADGEN_MARK)];
+    unsigned int tlen;
+};
+
+#define LOADGEN_PASTE \
+    "echo Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do " \
+    "eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim " \
+    "ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut " \
+    "aliquip ex ea commodo consequat."
+
+/* Every step makes the server answer with some output */
+static const struct loadgen_step
+loadgen_script[] = {
+    {"echo hello world", true},
+    {"\r", false},
+    {LOADGEN_PASTE, false},
+    {"\r", false},
+    {"\x10", false},            /* ^P: recall the paste */
+    {"\x01", false},            /* ^A: home */
+    {"\x1b[1;5C", false},       /* ^Right: next word */
+    {"again ", true},
+    {"\x05", false},            /* ^E: end */
+    {"\x1b\x7f", false},        /* Alt-Backspace: delete word */
+    {"\r", false},
+    {"\x10", false},            /* ^P */
+    {"\x10", false},            /* ^P */
+    {"\x0e", false},            /* ^N */
+    {"\r", false},
+};
+
+static unsigned long loadgen_histogram[LOADGEN_BUCKETS + 1];
+static unsigned long loadgen_steps, loadgen_bytes, loadgen_stalls;
+static unsigned long loadgen_backlogs;
+static uint64_t loadgen_max, loadgen_catchup;
+
+static uint64_t
+loadgen_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+loadgen_connect(const char *path)
+{
+    struct sockaddr_un addr = {};
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        err(errno, "socket");
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        err(errno, "connect %s", path);
+
+    return fd;
+}
+
+static void
+loadgen_record(uint64_t latency)
+{
+    uint64_t bucket = latency / LOADGEN_RESOLUTION;
+
+    if (bucket > LOADGEN_BUCKETS)
+        bucket = LOADGEN_BUCKETS;
+
+    ++loadgen_histogram[bucket];
+    if (latency > loadgen_max)
+        loadgen_max = latency;
+    ++loadgen_steps;
+}
+
+static uint64_t
+loadgen_percentile(unsigned int percent)
+{
+    unsigned long target, count;
+    unsigned int index;
+
+    target = (loadgen_steps * percent + 99) / 100;
+    for (index = count = 0; index < LOADGEN_BUCKETS; ++index) {
+        count += loadgen_histogram[index];
+        if (count >= target)
+            break;
+    }
+
+    return index * LOADGEN_RESOLUTION;
+}
+
+/* Send the next keystroke, a whole paste or escape sequence at once */
+static void
+loadgen_send(struct client *client)
+{
+    const struct loadgen_step *step;
+    unsigned int len;
+
+    step = &loadgen_script[client->step];
+    len = step->typed ? 1 : strlen(step->str);
+
+    client->sent = loadgen_clock();
+    client->busy = true;
+    if (write(client->fd, step->str + client->offset, len) != len)
+        err(errno, "write");
+    loadgen_bytes += len;
+
+    client->offset += len;
+    if (client->offset < strlen(step->str))
+        return;
+
+    client->offset = 0;
+    if (++client->step == BFDEV_ARRAY_SIZE(loadgen_script))
+        client->step = 0;
+}
+
+static void
+loadgen_drain(int fd)
+{
+    char buff[4096];
+
+    while (recv(fd, buff, sizeof(buff), MSG_DONTWAIT) > 0);
+}
+
+/*
+ * A slow reader stops reading, sends the script over and over so the
+ * output piles up in the server, then reads it all back up to the
+ * reply to a final marker command.
+ */
+static void
+loadgen_backlog(struct client *client, int epoll)
+{
+    struct epoll_event event;
+    unsigned int round, step, len;
+
+    event.events = 0;
+    event.data.ptr = client;
+    epoll_ctl(epoll, EPOLL_CTL_MOD, client->fd, &event);
+
+    for (round = 0; round < LOADGEN_BACKLOG; ++round) {
+        for (step = 0; step < BFDEV_ARRAY_SIZE(loadgen_script); ++step) {
+            len = strlen(loadgen_script[step].str);
+            if (write(client->fd, loadgen_script[step].str, len) != len)
+                err(errno, "write");
+            loadgen_bytes += len;
+        }
+    }
+
+    len = strlen(LOADGEN_SYNC);
+    if (write(client->fd, LOADGEN_SYNC, len) != len)
+        err(errno, "write");
+    loadgen_bytes += len;
+
+    event.events = EPOLLIN;
+    epoll_ctl(epoll, EPOLL_CTL_MOD, client->fd, &event);
+
+    client->sent = loadgen_clock();
+    client->busy = true;
+    client->tlen = 0;
+}
+
+/* Read the backlog, true once the marker reply came through */
+static bool
+loadgen_caught(struct client *client)
+{
+    char buff[4096 + sizeof(client->tail)];
+    ssize_t len, mlen = strlen(LOADGEN_MARK);
+
+    memcpy(buff, client->tail, client->tlen);
+    while ((len = recv(client->fd, buff + client->tlen, 4096, MSG_DONTWAIT)) > 0) {
+        len += client->tlen;
+        if (memmem(buff, len, LOADGEN_MARK, mlen)) {
+            loadgen_drain(client->fd);
+            return true;
+        }
+
+        /* The marker may be split between two reads */
+        client->tlen = len < mlen ? len : mlen;
+        memmove(buff, buff + len - client->tlen, client->tlen);
+    }
+
+    memcpy(client->tail, buff, client->tlen);
+    return false;
+}
+
+/* Ask the server for its memory statistics */
+static void
+loadgen_stats(const char *path)
+{
+    char buff[4096], *line;
+    size_t len = 0;
+    ssize_t retval;
+    int fd;
+
+    fd = loadgen_connect(path);
+    if (write(fd, "stats\r", 6) != 6)
+        err(errno, "write");
+
+    while (len < sizeof(buff) - 1) {
+        retval = read(fd, buff + len, sizeof(buff) - 1 - len);
+        if (retval <= 0)
+            break;
+
+        len += retval;
+        buff[len] = '\0';
+        line = strstr(buff, "sessions ");
+        if (line && strchr(line, '\n')) {
+            *strchr(line, '\n') = '\0';
+            printf("server: %s\n", line);
+            break;
+        }
+    }
+
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    struct epoll_event events[LOADGEN_EVENTS], event;
+    const char *path = LOADGEN_PATH;
+    unsigned int sessions = LOADGEN_SESSIONS;
+    unsigned int seconds = LOADGEN_SECONDS;
+    unsigned int slow = 0;
+    uint64_t start, now, elapsed;
+    struct client *clients, *client;
+    unsigned int index;
+    int epoll, count;
+
+    if (argc > 1)
+        path = argv[1];
+    if (argc > 2)
+        sessions = atoi(argv[2]);
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+    if (argc > 4)
+        slow = atoi(argv[4]);
+
+    clients = calloc(sessions, sizeof(*clients));
+    if (!clients)
+        err(ENOMEM, "calloc");
+
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        err(errno, "epoll_create1");
+
+    for (index = 0; index < sessions; ++index) {
+        client = &clients[index];
+        client->fd = loadgen_connect(path);
+
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, client->fd, &event))
+            err(errno, "epoll_ctl");
+
+        /* The first prompt starts the session */
+        client->sent = loadgen_clock();
+        client->busy = true;
+        client->slow = index < slow;
+    }
+
+    start = loadgen_clock();
+    do {
+        count = epoll_wait(epoll, events, LOADGEN_EVENTS, 100);
+        if (count < 0 && errno != EINTR)
+            err(errno, "epoll_wait");
+
+        now = loadgen_clock();
+        for (index = 0; index < (unsigned int)count; ++index) {
+            client = events[index].data.ptr;
+            if (client->slow) {
+                if (client->started && !loadgen_caught(client))
+                    continue;
+
+                if (client->started) {
+                    ++loadgen_backlogs;
+                    if (now - client->sent > loadgen_catchup)
+                        loadgen_catchup = now - client->sent;
+                }
+
+                loadgen_drain(client->fd);
+                client->started = true;
+                loadgen_backlog(client, epoll);
+                continue;
+            }
+
+            loadgen_drain(client->fd);
+            if (!client->busy)
+                continue;
+
+            /* One step in flight per session */
+            client->busy = false;
+            if (client->started)
+                loadgen_record(now - client->sent);
+            client->started = true;
+            loadgen_send(client);
+        }
+
+        for (index = 0; index < sessions; ++index) {
+            client = &clients[index];
+            if (client->busy && now > client->sent + LOADGEN_STALL) {
+                ++loadgen_stalls;
+
+                /* Sending more doesn't help a backlog that got stuck */
+                if (client->slow)
+                    client->sent = now;
+                else
+                    loadgen_send(client);
+            }
+        }
+    } while ((elapsed = now - start) < seconds * 1000000000ULL);
+
+    printf("sessions: %u, steps: %lu, bytes: %lu, stalls: %lu\n",
+           sessions, loadgen_steps, loadgen_bytes, loadgen_stalls);
+    printf("throughput: %.0f steps/s, %.0f bytes/s\n",
+           loadgen_steps * 1e9 / elapsed, loadgen_bytes * 1e9 / elapsed);
+    printf("latency: p50 %luus, p99 %luus, max %luus\n",
+           (unsigned long)(loadgen_percentile(50) / 1000),
+           (unsigned long)(loadgen_percentile(99) / 1000),
+           (unsigned long)(loadgen_max / 1000));
+    if (slow)
+        printf("slow readers: %u, backlogs: %lu, catch up max %luus\n",
+               slow, loadgen_backlogs, (unsigned long)(loadgen_catchup / 1000));
+
+    loadgen_stats(path);
+
+    for (index = 0; index < sessions; ++index)
+        close(clients[index].fd);
+    free(clients);
+
+    return 0;
+}
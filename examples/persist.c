@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <bfdev/macro.h>
+#include <bfrl/persist.h>
+
+#define PERSIST_PATH "persist.hist"
+#define PERSIST_LINES (BFRL_PERSIST_KEEP + 2000)
+#define PERSIST_DUPS 8
+#define PERSIST_MORE 1000
+#define PERSIST_RING (1U << 20)
+#define PERSIST_IDS (PERSIST_LINES + PERSIST_DUPS + PERSIST_MORE)
+
+static unsigned int persist_ids[PERSIST_LINES];
+static unsigned int persist_last[PERSIST_IDS];
+static unsigned int persist_seen[PERSIST_IDS];
+static unsigned int persist_loaded[PERSIST_LINES + PERSIST_MORE];
+static unsigned int persist_count;
+static int persist_failed;
+
+/* A few repeated lines, and some that need escaping */
+static unsigned int
+persist_text(char *buff, unsigned int id)
+{
+    if (id < PERSIST_DUPS)
+        return sprintf(buff, "dup %u", id);
+    if (!(id % 16))
+        return sprintf(buff, "esc %u back\\slash\nnew line", id);
+
+    return sprintf(buff, "line %05u of the persistence test", id);
+}
+
+static void
+persist_fail(const char *what, unsigned int index)
+{
+    printf("%s at %u\n", what, index);
+    ++persist_failed;
+}
+
+static void
+persist_commit(struct bfrl_state *state, unsigned int id)
+{
+    char buff[64];
+
+    if (bfrl_history_add(state, buff, persist_text(buff, id)))
+        err(ENOMEM, "bfrl_history_add");
+}
+
+/* Load @path into a new state and collect the ids, oldest first */
+static struct bfrl_state *
+persist_load(const char *path, enum bfrl_persist_policy policy,
+             unsigned int size)
+{
+    struct bfrl_history *history;
+    struct bfrl_state *state;
+    unsigned int id, len;
+    char buff[64], line[64];
+
+    state = bfrl_alloc(NULL, NULL, NULL, NULL);
+    if (!state)
+        err(ENOMEM, "bfrl_alloc");
+
+    if (!bfrl_persist_start(NULL, state, path, size, policy))
+        err(EIO, "bfrl_persist_start %s", path);
+
+    persist_count = 0;
+    bfdev_list_for_each_entry_reverse(history, &state->history, list) {
+        len = history->len < sizeof(line) ? history->len : sizeof(line) - 1;
+        memcpy(line, history->cmd, len);
+        line[len] = '\0';
+
+        if (sscanf(line, "%*s %u", &id) != 1 || id >= PERSIST_IDS ||
+            history->len != persist_text(buff, id) ||
+            memcmp(history->cmd, buff, history->len)) {
+            persist_fail("garbled line", persist_count);
+            continue;
+        }
+
+        if (persist_count < BFDEV_ARRAY_SIZE(persist_loaded))
+            persist_loaded[persist_count++] = id;
+    }
+
+    return state;
+}
+
+/*
+ * Commit more lines than a compaction keeps, reload, and check that
+ * the last BFRL_PERSIST_KEEP distinct lines came back in order.
+ */
+static void
+persist_compact(const char *path)
+{
+    struct bfrl_state *state;
+    unsigned int index, id, keep, walk, dups;
+
+    state = persist_load(path, BFRL_PERSIST_BLOCK, 0);
+    for (index = 0; index < PERSIST_LINES; ++index) {
+        id = index % 4 == 3 ? index / 4 % PERSIST_DUPS : PERSIST_DUPS + index;
+        persist_ids[index] = id;
+        persist_last[id] = index + 1;
+        persist_commit(state, id);
+    }
+
+    if (bfrl_persist_stop(state->persist))
+        persist_fail("stop failed", 0);
+    bfrl_free(state);
+
+    state = persist_load(path, BFRL_PERSIST_BLOCK, 0);
+    printf("compact: %u lines committed, %u loaded\n",
+           PERSIST_LINES, persist_count);
+
+    /* Without a compaction every copy of a repeated line is still there */
+    for (index = dups = 0; index < persist_count; ++index)
+        dups += !persist_loaded[index];
+    if (persist_count >= PERSIST_LINES || dups >= PERSIST_LINES / 4 / PERSIST_DUPS)
+        persist_fail("no compaction", persist_count);
+
+    /* The newest copies, newest first, against the committed order */
+    walk = persist_count;
+    for (index = PERSIST_LINES, keep = 0; index-- && keep < BFRL_PERSIST_KEEP;) {
+        id = persist_ids[index];
+        if (persist_last[id] != index + 1)
+            continue;
+
+        while (walk && (persist_seen[persist_loaded[walk - 1]] ||
+                        persist_last[persist_loaded[walk - 1]] > index + 1)) {
+            persist_seen[persist_loaded[walk - 1]] = 1;
+            --walk;
+        }
+
+        if (!walk || persist_loaded[walk - 1] != id) {
+            persist_fail("lost or reordered line", index);
+            break;
+        }
+
+        persist_seen[id] = 1;
+        --walk;
+        ++keep;
+    }
+
+    bfrl_free(state);
+}
+
+/* A queue that never fills must not drop anything, whatever the policy */
+static void
+persist_policy(const char *path, enum bfrl_persist_policy policy,
+               unsigned int base)
+{
+    struct bfrl_state *state;
+    unsigned long dropped;
+    unsigned int index, start;
+
+    state = persist_load(path, policy, PERSIST_RING);
+    for (index = 0; index < PERSIST_MORE / 2; ++index)
+        persist_commit(state, base + index);
+
+    /* Freeing the state waits for the queue to reach the file */
+    dropped = atomic_load(&state->persist->dropped);
+    bfrl_free(state);
+
+    state = persist_load(path, BFRL_PERSIST_BLOCK, 0);
+    printf("%s: %u lines committed, %lu dropped\n",
+           policy == BFRL_PERSIST_DROP ? "drop" : "block",
+           PERSIST_MORE / 2, dropped);
+
+    if (dropped || persist_count < PERSIST_MORE / 2) {
+        persist_fail("dropped lines", 0);
+        bfrl_free(state);
+        return;
+    }
+
+    start = persist_count - PERSIST_MORE / 2;
+    for (index = 0; index < PERSIST_MORE / 2; ++index) {
+        if (persist_loaded[start + index] != base + index) {
+            persist_fail("lost or reordered line", index);
+            break;
+        }
+    }
+
+    bfrl_free(state);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = PERSIST_PATH;
+
+    if (argc > 1)
+        path = argv[1];
+
+    unlink(path);
+    persist_compact(path);
+    persist_policy(path, BFRL_PERSIST_DROP, PERSIST_DUPS + PERSIST_LINES);
+    persist_policy(path, BFRL_PERSIST_BLOCK,
+                   PERSIST_DUPS + PERSIST_LINES + PERSIST_MORE / 2);
+    unlink(path);
+
+    printf("%d failed\n", persist_failed);
+    return !!persist_failed;
+}
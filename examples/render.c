@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bfdev/macro.h>
+#include <bfrl/core.h>
+#include "screen.h"
+
+#define RENDER_ROWS 4
+
+struct render_case {
+    unsigned int cols;
+    const char *input;
+    const char *rows[RENDER_ROWS];
+};
+
+/* Wide characters wrapping and unwrapping at the right margin */
+static const struct render_case
+render_cases[] = {
+    { 6, "abcd\x02\xe4\xbd\xa0", { "# abc", "\xe4\xbd\xa0" "d" } },
+    { 6, "abcd\x02\xe4\xbd\xa0\x01\x04", { "# bc\xe4\xbd\xa0", "d" } },
+    { 6, "abcd\x02\xe4\xbd\xa0\x1b[D\x1b[D\x04", { "# ab\xe4\xbd\xa0", "d" } },
+    { 6, "abcde\x02\x02\xe4\xbd\xa0\x1b[3~", { "# abc", "\xe4\xbd\xa0" "e" } },
+    { 6, "\xe4\xbd\xa0" "a\xe4\xbd\xa0" "b\x01\x04", { "# a\xe4\xbd\xa0" "b" } },
+    { 6, "\xe4\xbd\xa0" "a\xe4\xbd\xa0" "b\x01\x04\x04", { "# \xe4\xbd\xa0" "b" } },
+    { 6, "x\\\xe4\xbd\xa0\x01\x06\xe4\xbd\xa0", { "# x\xe4\xbd\xa0\\", "\xe4\xbd\xa0" } },
+#ifdef BFRL_WORDMOVE
+    { 6, "ab \xe4\xbd\xa0" "cd\x01\x1b" "d", { "#  \xe4\xbd\xa0" "c", "d" } },
+#endif
+    { 7, "abc\xf0\x9f\x98\x80\xf0\x9f\x98\x80\x01\x06\x06\x06\x7f", { "# ab\xf0\x9f\x98\x80", "\xf0\x9f\x98\x80" } },
+    { 5, "a\xe4\xbd\xa0\xe4\xbd\xa0\xe4\xbd\xa0\x01\x04\x04", { "# \xe4\xbd\xa0", "\xe4\xbd\xa0" } },
+    { 3, "\xe4\xbd\xa0", { "#", "\xe4\xbd\xa0" } },
+};
+
+static struct screen screen;
+
+/* Title, colored wide text, a bare escape, a counter and the sign */
+static const char *
+render_segments[] = {
+    "\x1b]0;render\a", "\x1b[1;34m\xe4\xbd\xa0\xe5\xa5\xbd\x1b[0m", "\x1b=",
+    " [0] ", "$ ",
+};
+
+static void
+render_write(const char *str, unsigned int len, void *data)
+{
+    screen_write(data, str, len);
+}
+
+static int
+render_line(struct bfrl_state *state, struct bfrl_prompt *dprompt,
+            struct bfrl_prompt *cprompt, const char *input)
+{
+    const char *line;
+
+    bfrl_start_prompt(state, dprompt, cprompt);
+    line = bfrl_feed(state, input, strlen(input), NULL);
+
+    if (screen_check(&screen, state, dprompt->buff, cprompt->buff) >= 0) {
+        printf("prompt: line \"%s\" shows \"%s\"\n", input,
+               screen_line(&screen, screen.row));
+        return 1;
+    }
+
+    if (!line)
+        bfrl_feed(state, "\r", 1, NULL);
+
+    return 0;
+}
+
+/* A prompt built from segments, one of them changed between lines */
+static int
+render_prompt(void)
+{
+    struct bfrl_prompt *dprompt, *cprompt;
+    struct bfrl_state *state;
+    unsigned int index;
+    int failed;
+
+    state = bfrl_alloc(NULL, NULL, render_write, &screen);
+    dprompt = bfrl_prompt_alloc(NULL, render_segments[0]);
+    cprompt = bfrl_prompt_alloc(NULL, "> ");
+    if (!state || !dprompt || !cprompt)
+        return 1;
+
+    for (failed = 0, index = 1; index < BFDEV_ARRAY_SIZE(render_segments); ++index)
+        failed |= !!bfrl_prompt_update(dprompt, index, render_segments[index],
+                                       strlen(render_segments[index]));
+
+    if (dprompt->width != 11 ||
+        bfrl_prompt_update(dprompt, dprompt->nsegs + 1, "x", 1) != -BFDEV_EINVAL) {
+        printf("prompt: width %u\n", dprompt->width);
+        failed = 1;
+    }
+
+    screen_reset(&screen, 16);
+    bfrl_resize(state, 16, 24);
+    failed |= render_line(state, dprompt, cprompt, "ls \xe4\xbd\xa0");
+
+    bfrl_prompt_update(dprompt, 3, " [12] ", 6);
+    if (dprompt->width != 12) {
+        printf("prompt: width %u after the update\n", dprompt->width);
+        failed = 1;
+    }
+
+    failed |= render_line(state, dprompt, cprompt, "echo \xe4\xbd\xa0\xe5\xa5\xbd\x02\x02");
+    failed |= render_line(state, dprompt, cprompt, "a\\\nb \xe4\xbd\xa0\x1b[A");
+
+    bfrl_prompt_free(cprompt);
+    bfrl_prompt_free(dprompt);
+    bfrl_free(state);
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct render_case *rcase;
+    struct bfrl_delta delta;
+    struct bfrl_core *core;
+    unsigned int index, row, origin;
+    int failed, diff;
+
+    for (failed = index = 0; index < BFDEV_ARRAY_SIZE(render_cases); ++index) {
+        rcase = &render_cases[index];
+        core = bfrl_core_create(NULL, rcase->cols, 24);
+        if (!core)
+            return 1;
+
+        screen_reset(&screen, rcase->cols);
+        bfrl_core_start(core, "# ", "> ", &delta);
+        screen_write(&screen, delta.render, delta.rlen);
+
+        bfrl_core_feed(core, rcase->input, strlen(rcase->input), &delta);
+        screen_write(&screen, delta.render, delta.rlen);
+
+        diff = screen_check(&screen, core->state, "# ", "> ");
+        origin = screen.row - core->state->row;
+
+        for (row = 0; diff < 0 && row < RENDER_ROWS; ++row) {
+            if (strcmp(screen_line(&screen, origin + row),
+                       rcase->rows[row] ? rcase->rows[row] : ""))
+                diff = row;
+        }
+
+        if (diff >= 0) {
+            printf("case %u: row %d shows \"%s\", cursor at %u:%u\n", index,
+                   diff, screen_line(&screen, origin + diff), screen.row - origin,
+                   screen.col);
+            ++failed;
+        }
+
+        bfrl_core_destroy(core);
+    }
+
+    if (render_prompt())
+        ++failed;
+
+    printf("%u cases and a prompt, %d failed\n", index, failed);
+    return !!failed;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+#include <bfrl/record.h>
+
+/* Generous enough for sanitizer builds, an event takes microseconds */
+#define REPLAY_BUDGET 50000000ULL
+#define REPLAY_CHUNK 7
+
+struct replay_buffer {
+    char *data;
+    unsigned long len;
+    unsigned long size;
+};
+
+static const char
+replay_script[] =
+    "echo hello world\r"
+    "echo a long line\x1b[D\x1b[D\x1b[1;5D\x1b""d\x1b[F\r"
+    "help \\\nme\x1b[A\x02\x02X\r"
+    "\x1b\x7f\x1b\x7f" "exit\r";
+
+static unsigned long replay_index;
+
+static uint64_t
+replay_clock(void *data)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+replay_append(const char *str, unsigned int len, void *data)
+{
+    struct replay_buffer *buff = data;
+
+    if (buff->len + len > buff->size) {
+        buff->size = (buff->len + len) * 2;
+        buff->data = realloc(buff->data, buff->size);
+        if (!buff->data)
+            err(-ENOMEM, "realloc");
+    }
+
+    memcpy(buff->data + buff->len, str, len);
+    buff->len += len;
+}
+
+static unsigned int
+replay_read(char *str, unsigned int len, void *data)
+{
+    if (replay_index >= sizeof(replay_script) - 1)
+        return 0;
+
+    *str = replay_script[replay_index++];
+    return 1;
+}
+
+static void
+replay_write(const char *str, unsigned int len, void *data)
+{
+    replay_append(str, len, data);
+}
+
+static void
+replay_load(struct replay_buffer *log, const char *path)
+{
+    char chunk[4096];
+    size_t len;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file)
+        err(errno, "%s", path);
+
+    while ((len = fread(chunk, 1, sizeof(chunk), file)))
+        replay_append(chunk, len, log);
+
+    fclose(file);
+}
+
+/* Record the built-in script against a fake 32 column terminal */
+static void
+replay_capture(struct replay_buffer *log)
+{
+    struct replay_buffer screen = {};
+    struct bfrl_record *record;
+    struct bfrl_state *rstate;
+    const char *line;
+
+    rstate = bfrl_alloc(NULL, replay_read, replay_write, &screen);
+    if (!rstate)
+        err(-ENOMEM, "bfrl_alloc");
+
+    bfrl_resize(rstate, 32, 24);
+    record = bfrl_record_start(NULL, rstate, replay_append, replay_clock, log);
+    if (!record)
+        err(-ENOMEM, "bfrl_record_start");
+
+    do {
+        line = bfrl_readline(rstate, "# ", "> ");
+    } while (!line || strcmp(line, "exit"));
+
+    bfrl_record_stop(record);
+    bfrl_free(rstate);
+    free(screen.data);
+}
+
+/*
+ * The same script fed in chunks the way an event loop does, with a
+ * lone escape that only a timeout turns into a key.
+ */
+static void
+replay_capture_feed(struct replay_buffer *log)
+{
+    struct replay_buffer screen = {};
+    struct bfrl_record *record;
+    struct bfrl_state *rstate;
+    unsigned int walk, used, len;
+
+    rstate = bfrl_alloc(NULL, NULL, replay_write, &screen);
+    if (!rstate)
+        err(-ENOMEM, "bfrl_alloc");
+
+    bfrl_resize(rstate, 32, 24);
+    record = bfrl_record_start(NULL, rstate, replay_append, replay_clock, log);
+    if (!record)
+        err(-ENOMEM, "bfrl_record_start");
+
+    bfrl_start(rstate, "# ", "> ");
+    for (walk = 0; walk < sizeof(replay_script) - 1; walk += used) {
+        len = sizeof(replay_script) - 1 - walk;
+        if (len > REPLAY_CHUNK)
+            len = REPLAY_CHUNK;
+        if (bfrl_feed(rstate, replay_script + walk, len, &used))
+            bfrl_start(rstate, "# ", "> ");
+    }
+
+    bfrl_feed(rstate, "\x1b", 1, NULL);
+    bfrl_expire(rstate);
+
+    bfrl_record_stop(record);
+    bfrl_free(rstate);
+    free(screen.data);
+}
+
+static int
+replay_check(const char *name, struct replay_buffer *log)
+{
+    struct bfrl_replay replay = {};
+    struct bfrl_state *rstate;
+    int retval;
+
+    rstate = bfrl_alloc(NULL, NULL, NULL, NULL);
+    if (!rstate)
+        err(-ENOMEM, "bfrl_alloc");
+
+    replay.clock = replay_clock;
+    replay.budget = REPLAY_BUDGET;
+    retval = bfrl_replay(rstate, &replay, "# ", "> ", log->data, log->len);
+
+    printf("%s: log %lu bytes\n", name, log->len);
+    printf("input: %lu bytes, %lu events, %lu lines\n",
+           replay.input, replay.events, replay.lines);
+    printf("output: %lu bytes, %lu expected\n", replay.output, replay.expect);
+    printf("latency: max %lluns at event %lu, total %lluns\n",
+           (unsigned long long)replay.latency_max, replay.slowest,
+           (unsigned long long)replay.latency_total);
+
+    if (retval == -BFDEV_EBADMSG)
+        printf("output differs at byte %lu\n", replay.mismatch);
+    else if (retval == -BFDEV_ETIMEDOUT)
+        printf("%lu events over the %lluns budget\n", replay.overrun,
+               (unsigned long long)replay.budget);
+
+    bfrl_free(rstate);
+    free(log->data);
+
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    struct replay_buffer log = {};
+    int retval;
+
+    if (argc > 1) {
+        replay_load(&log, argv[1]);
+        return !!replay_check(argv[1], &log);
+    }
+
+    replay_capture(&log);
+    retval = replay_check("readline", &log);
+
+    memset(&log, 0, sizeof(log));
+    replay_capture_feed(&log);
+    retval = replay_check("feed", &log) ?: retval;
+
+    return !!retval;
+}
@@ -0,0 +1,451 @@
+#ifndef _EXAMPLES_SCREEN_H_
+#define _EXAMPLES_SCREEN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <bfrl/readline.h>
+
+#define SCREEN_COLS 128
+#define SCREEN_ROWS 512
+#define SCREEN_BLANK 0
+#define SCREEN_WIDE 0xffffffffU
+
+/*
+ * Just enough of a VT100 style terminal to check what the editor
+ * draws: text with autowrap, relative cursor motion and erasing on a
+ * tall screen. Attributes and OSC strings are parsed and dropped.
+ * Characters outside the small width table set @unknown, as the
+ * terminal and the editor may disagree on where they end. @bottom
+ * is the lowest row anything was drawn on. Spaces are stored as
+ * blank cells, so a zeroed screen is an empty one.
+ */
+struct screen {
+    unsigned int cols;
+    unsigned int row;
+    unsigned int col;
+    unsigned int bottom;
+    bool pending;
+    bool eager;
+    bool unknown;
+    uint32_t cells[SCREEN_ROWS][SCREEN_COLS];
+};
+
+static inline int
+screen_width(uint32_t code)
+{
+    if (code >= 0x20 && code < 0x7f)
+        return 1;
+    if (code >= 0xa0 && code < 0x300)
+        return 1;
+    if (code >= 0x300 && code < 0x370)
+        return 0;
+    if (code >= 0x4e00 && code < 0xa000)
+        return 2;
+    if (code >= 0x1f600 && code < 0x1f650)
+        return 2;
+
+    return -1;
+}
+
+static inline void
+screen_erase(struct screen *screen, unsigned int row, unsigned int col)
+{
+    memset(screen->cells[row] + col, SCREEN_BLANK,
+           (SCREEN_COLS - col) * sizeof(screen->cells[row][col]));
+}
+
+static inline void
+screen_reset(struct screen *screen, unsigned int cols)
+{
+    unsigned int row;
+
+    screen->cols = cols;
+    for (row = 0; row <= screen->bottom; ++row)
+        screen_erase(screen, row, 0);
+
+    screen->row = screen->col = 0;
+    screen->bottom = 0;
+    screen->pending = false;
+    screen->unknown = false;
+}
+
+static inline void
+screen_resize(struct screen *screen, unsigned int cols)
+{
+    unsigned int row;
+
+    /* Clip what no longer fits, like xterm does */
+    for (row = 0; row <= screen->bottom; ++row)
+        screen_erase(screen, row, cols);
+
+    screen->cols = cols;
+    if (screen->col >= cols)
+        screen->col = cols - 1;
+    screen->pending = false;
+}
+
+static inline void
+screen_newline(struct screen *screen)
+{
+    screen->pending = false;
+    if (screen->row + 1 < SCREEN_ROWS) {
+        ++screen->row;
+        return;
+    }
+
+    /* Scrolling moves everything, the caller has to start over */
+    screen->unknown = true;
+
+    memmove(screen->cells[0], screen->cells[1],
+            sizeof(screen->cells) - sizeof(screen->cells[0]));
+    screen_erase(screen, SCREEN_ROWS - 1, 0);
+}
+
+static inline void
+screen_put(struct screen *screen, uint32_t code)
+{
+    uint32_t *cells;
+    int width;
+
+    width = screen_width(code);
+    if (width < 0) {
+        screen->unknown = true;
+        width = 1;
+    }
+
+    /* Combining marks go with the previous cell */
+    if (!width)
+        return;
+
+    if (screen->pending || screen->col + width > screen->cols) {
+        screen_newline(screen);
+        screen->col = 0;
+    }
+
+    /* Half of an overwritten wide character is gone as well */
+    cells = screen->cells[screen->row];
+    if (cells[screen->col] == SCREEN_WIDE && screen->col)
+        cells[screen->col - 1] = SCREEN_BLANK;
+    if (screen->col + width < screen->cols &&
+        cells[screen->col + width] == SCREEN_WIDE)
+        cells[screen->col + width] = SCREEN_BLANK;
+
+    cells[screen->col] = code == ' ' ? SCREEN_BLANK : code;
+    if (width == 2)
+        cells[screen->col + 1] = SCREEN_WIDE;
+    if (screen->row > screen->bottom)
+        screen->bottom = screen->row;
+
+    screen->col += width;
+    if (screen->col < screen->cols)
+        return;
+
+    /*
+     * A terminal holds the cursor on the last column until the next
+     * character arrives, @eager wraps right away like the layout.
+     */
+    if (screen->eager) {
+        screen_newline(screen);
+        screen->col = 0;
+    } else {
+        screen->col = screen->cols - 1;
+        screen->pending = true;
+    }
+}
+
+static inline unsigned int
+screen_csi(struct screen *screen, const char *str, unsigned int len)
+{
+    unsigned int index, arg[2], narg, count;
+
+    arg[0] = arg[1] = narg = 0;
+    for (index = 0; index < len; ++index) {
+        if (str[index] >= '0' && str[index] <= '9') {
+            arg[narg] = arg[narg] * 10 + str[index] - '0';
+            continue;
+        }
+        if (str[index] == ';') {
+            if (narg < 1)
+                ++narg;
+            continue;
+        }
+        if (str[index] == '?')
+            continue;
+        break;
+    }
+
+    if (index == len)
+        return len;
+
+    count = arg[0] ? arg[0] : 1;
+    switch (str[index]) {
+        case 'A':
+            screen->row -= count < screen->row ? count : screen->row;
+            break;
+
+        case 'B':
+            screen->row += count;
+            if (screen->row >= SCREEN_ROWS)
+                screen->row = SCREEN_ROWS - 1;
+            break;
+
+        case 'C':
+            screen->col += count;
+            if (screen->col >= screen->cols)
+                screen->col = screen->cols - 1;
+            break;
+
+        case 'D':
+            screen->col -= count < screen->col ? count : screen->col;
+            break;
+
+        case 'H':
+            screen->row = arg[0] ? arg[0] - 1 : 0;
+            screen->col = arg[1] ? arg[1] - 1 : 0;
+            break;
+
+        case 'K':
+            screen_erase(screen, screen->row, screen->col);
+            break;
+
+        case 'J':
+            if (arg[0] == 2) {
+                screen_reset(screen, screen->cols);
+                break;
+            }
+            screen_erase(screen, screen->row, screen->col);
+            for (narg = screen->row + 1; narg <= screen->bottom; ++narg)
+                screen_erase(screen, narg, 0);
+            break;
+
+        default:
+            /* Attributes and anything else leave the cells alone */
+            return index + 1;
+    }
+
+    screen->pending = false;
+    return index + 1;
+}
+
+static inline unsigned int
+screen_escape(struct screen *screen, const char *str, unsigned int len)
+{
+    unsigned int index;
+
+    if (len < 2)
+        return len;
+
+    if (str[1] == '[')
+        return 2 + screen_csi(screen, str + 2, len - 2);
+
+    if (str[1] != ']')
+        return 2;
+
+    /* OSC ends with BEL or ST */
+    for (index = 2; index < len; ++index) {
+        if (str[index] == '\a')
+            return index + 1;
+        if (str[index] == '\e' && index + 1 < len && str[index + 1] == '\\')
+            return index + 2;
+    }
+
+    return len;
+}
+
+static inline unsigned int
+screen_decode(const char *str, unsigned int len, uint32_t *code)
+{
+    const unsigned char *ustr = (const unsigned char *)str;
+    unsigned int count, index;
+
+    if (ustr[0] < 0x80) {
+        *code = ustr[0];
+        return 1;
+    }
+
+    count = ustr[0] >= 0xf0 ? 4 : ustr[0] >= 0xe0 ? 3 : 2;
+    *code = ustr[0] & (0x7f >> count);
+    if (ustr[0] < 0xc2 || ustr[0] > 0xf4 || count > len)
+        goto invalid;
+
+    for (index = 1; index < count; ++index) {
+        if ((ustr[index] & 0xc0) != 0x80)
+            goto invalid;
+        *code = (*code << 6) | (ustr[index] & 0x3f);
+    }
+
+    return count;
+
+invalid:
+    *code = 0xfffd;
+    return 1;
+}
+
+static inline void
+screen_write(struct screen *screen, const char *str, unsigned int len)
+{
+    unsigned int index;
+    uint32_t code;
+
+    for (index = 0; index < len;) {
+        switch (str[index]) {
+            case '\e':
+                index += screen_escape(screen, str + index, len - index);
+                break;
+
+            case '\r':
+                screen->col = 0;
+                screen->pending = false;
+                ++index;
+                break;
+
+            case '\n':
+                /* The tty turns it into CR LF */
+                screen_newline(screen);
+                screen->col = 0;
+                ++index;
+                break;
+
+            case '\a': case '\b': case '\t':
+                ++index;
+                break;
+
+            default:
+                index += screen_decode(str + index, len - index, &code);
+                screen_put(screen, code);
+        }
+    }
+}
+
+/*
+ * What a fresh repaint of @buff shows, with the cursor put where @pos
+ * ends up. Rows that end with a newline go on with @cprompt.
+ */
+static inline void
+screen_expect(struct screen *screen, unsigned int cols, const char *prompt,
+              const char *cprompt, const char *buff, unsigned int len,
+              unsigned int pos, unsigned int *row, unsigned int *col)
+{
+    unsigned int index, step;
+    uint32_t code;
+    int width;
+
+    screen_reset(screen, cols);
+    screen->eager = true;
+    screen_write(screen, prompt, strlen(prompt));
+
+    for (index = 0;; index += step) {
+        if (index >= len || buff[index] == '\n') {
+            step = 1;
+            width = 0;
+        } else {
+            step = screen_decode(buff + index, len - index, &code);
+            width = screen_width(code);
+        }
+
+        /* In front of a character that wraps, the cursor is on it */
+        if (index == pos) {
+            *row = screen->row;
+            *col = screen->col;
+            if (width > 0 && screen->col + width > cols) {
+                ++*row;
+                *col = 0;
+            }
+        }
+
+        if (index >= len)
+            break;
+
+        if (buff[index] == '\n') {
+            screen_newline(screen);
+            screen->col = 0;
+            screen_write(screen, cprompt, strlen(cprompt));
+            continue;
+        }
+
+        screen_put(screen, code);
+    }
+
+    screen->eager = false;
+}
+
+/* Row @row as UTF-8 without trailing blanks, for messages and tests */
+static inline const char *
+screen_line(struct screen *screen, unsigned int row)
+{
+    static char line[SCREEN_COLS * 4 + 1];
+    unsigned int col, len, end;
+    uint32_t code;
+
+    for (col = len = end = 0; col < screen->cols; ++col) {
+        code = screen->cells[row][col];
+        if (code == SCREEN_WIDE)
+            continue;
+        if (code == SCREEN_BLANK)
+            code = ' ';
+
+        if (code < 0x80)
+            line[len++] = code;
+        else if (code < 0x800) {
+            line[len++] = 0xc0 | (code >> 6);
+            line[len++] = 0x80 | (code & 0x3f);
+        } else if (code < 0x10000) {
+            line[len++] = 0xe0 | (code >> 12);
+            line[len++] = 0x80 | ((code >> 6) & 0x3f);
+            line[len++] = 0x80 | (code & 0x3f);
+        } else {
+            line[len++] = 0xf0 | (code >> 18);
+            line[len++] = 0x80 | ((code >> 12) & 0x3f);
+            line[len++] = 0x80 | ((code >> 6) & 0x3f);
+            line[len++] = 0x80 | (code & 0x3f);
+        }
+
+        if (code != ' ')
+            end = len;
+    }
+
+    line[end] = '\0';
+    return line;
+}
+
+/*
+ * Compare @screen with a fresh repaint of the line in @state, lined
+ * up on the cursor. Returns the first row that differs, counted from
+ * the prompt row, or -1 if the screen shows the line as it is or
+ * unknown characters make it impossible to tell.
+ */
+static inline int
+screen_check(struct screen *screen, struct bfrl_state *state,
+             const char *prompt, const char *cprompt)
+{
+    static struct screen expect;
+    unsigned int origin, row, col, last;
+
+    screen_expect(&expect, screen->cols, prompt, cprompt,
+                  state->buff, state->len, state->pos, &row, &col);
+
+    if (screen->unknown || expect.unknown)
+        return -1;
+
+    if (screen->row < row)
+        return 0;
+
+    origin = screen->row - row;
+    if (screen->col != col || screen->pending)
+        return row;
+
+    last = expect.bottom > row ? expect.bottom : row;
+    if (screen->bottom > origin + last)
+        last = screen->bottom - origin;
+
+    for (row = 0; row <= last; ++row) {
+        if (memcmp(screen->cells[origin + row], expect.cells[row],
+                   sizeof(expect.cells[row])))
+            return row;
+    }
+
+    return -1;
+}
+
+#endif /* _EXAMPLES_SCREEN_H_ */
@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <bfrl/pool.h>
+
+#define SERVER_PATH "/tmp/bfrl.sock"
+#define SERVER_EVENTS 256
+#define SERVER_CHUNK 4096
+#define SERVER_POOL 1024
+
+struct session {
+    struct bfdev_list_head pending;
+    struct bfrl_state *rstate;
+    uint64_t deadline;
+    int fd;
+    bool waiting;
+    bool closing;
+    bool corked;
+    bool output;
+
+    char *obuf;
+    size_t olen;
+    size_t osize;
+};
+
+static BFDEV_LIST_HEAD(server_pending);
+static struct bfrl_pool *server_pool;
+static unsigned int server_sessions;
+static size_t server_baseline;
+static int server_epoll;
+
+static uint64_t
+server_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void
+session_events(struct session *session, bool output)
+{
+    struct epoll_event event;
+
+    if (session->output == output)
+        return;
+
+    session->output = output;
+    event.events = output ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = session;
+    epoll_ctl(server_epoll, EPOLL_CTL_MOD, session->fd, &event);
+}
+
+/* Keep what the socket didn't take and wait until it is writable */
+static void
+session_queue(struct session *session, const char *str, size_t len)
+{
+    char *nblk;
+
+    if (!len)
+        return;
+
+    if (session->olen + len > session->osize) {
+        session->osize = (session->olen + len) * 2;
+        nblk = realloc(session->obuf, session->osize);
+        if (!nblk) {
+            session->closing = true;
+            return;
+        }
+        session->obuf = nblk;
+    }
+
+    if (!session->olen && !session->corked)
+        session_events(session, true);
+
+    memcpy(session->obuf + session->olen, str, len);
+    session->olen += len;
+}
+
+static void
+session_writev(const struct bfrl_iovec *iov, unsigned int count, void *data)
+{
+    struct session *session = data;
+    unsigned int index;
+    ssize_t retval;
+    size_t skip;
+
+    if (session->closing)
+        return;
+
+    retval = 0;
+    if (!session->olen && !session->corked) {
+        retval = writev(session->fd, (const struct iovec *)iov, count);
+        if (retval < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                session->closing = true;
+                return;
+            }
+            retval = 0;
+        }
+    }
+
+    for (index = 0; index < count; ++index) {
+        skip = (size_t)retval < iov[index].len ? (size_t)retval : iov[index].len;
+        retval -= skip;
+        session_queue(session, (const char *)iov[index].base + skip,
+                      iov[index].len - skip);
+    }
+}
+
+static void
+session_write(const char *str, unsigned int len, void *data)
+{
+    struct bfrl_iovec iov;
+
+    iov.base = str;
+    iov.len = len;
+    session_writev(&iov, 1, data);
+}
+
+static unsigned int
+session_read(char *str, unsigned int len, void *data)
+{
+    /* Input arrives through bfrl_feed */
+    return 0;
+}
+
+static void
+session_flush(struct session *session)
+{
+    ssize_t retval;
+
+    if (!session->olen)
+        return;
+
+    retval = write(session->fd, session->obuf, session->olen);
+    if (retval < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            session->closing = true;
+            return;
+        }
+        retval = 0;
+    }
+
+    /* Whatever is left waits for EPOLLOUT, also after an uncork */
+    session->olen -= retval;
+    memmove(session->obuf, session->obuf + retval, session->olen);
+    session_events(session, !!session->olen);
+}
+
+/*
+ * Everything a batch of input produces is sent with one write, so each
+ * round trip costs one syscall and the client sees a single reply.
+ */
+static inline void
+session_cork(struct session *session)
+{
+    session->corked = !session->olen;
+}
+
+static inline void
+session_uncork(struct session *session)
+{
+    if (!session->corked)
+        return;
+
+    session->corked = false;
+    session_flush(session);
+}
+
+static void
+session_close(struct session *session)
+{
+    epoll_ctl(server_epoll, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+
+    if (session->waiting)
+        bfdev_list_del(&session->pending);
+
+    bfrl_pool_put(server_pool, session->rstate);
+    free(session->obuf);
+    free(session);
+    --server_sessions;
+}
+
+static void
+session_line(struct session *session, const char *line)
+{
+    char reply[128];
+    size_t heap;
+    int len;
+
+    if (!strcmp(line, "exit")) {
+        session->closing = true;
+        return;
+    }
+
+    if (!strcmp(line, "stats")) {
+        heap = mallinfo2().uordblks - server_baseline;
+        len = snprintf(reply, sizeof(reply),
+                       "sessions %u, heap %zu bytes, %zu bytes per session\n",
+                       server_sessions, heap, heap / server_sessions);
+        session_write(reply, len, session);
+    } else {
+        session_write(line, strlen(line), session);
+        session_write("\n", 1, session);
+    }
+
+    bfrl_start(session->rstate, "# ", "> ");
+}
+
+/* Sessions in the middle of an escape sequence wait for a timeout */
+static void
+session_timer(struct session *session)
+{
+    unsigned int timeout;
+
+    timeout = bfrl_pending(session->rstate);
+    if (!timeout) {
+        if (session->waiting)
+            bfdev_list_del(&session->pending);
+        session->waiting = false;
+        return;
+    }
+
+    session->deadline = server_clock() + timeout;
+    if (!session->waiting)
+        bfdev_list_add_tail(&server_pending, &session->pending);
+    session->waiting = true;
+}
+
+static void
+session_input(struct session *session)
+{
+    char chunk[SERVER_CHUNK];
+    unsigned int walk, used;
+    const char *line;
+    ssize_t len;
+
+    len = read(session->fd, chunk, sizeof(chunk));
+    if (len <= 0) {
+        if (!len || (errno != EAGAIN && errno != EWOULDBLOCK))
+            session->closing = true;
+        return;
+    }
+
+    session_cork(session);
+    for (walk = 0; walk < len && !session->closing; walk += used) {
+        line = bfrl_feed(session->rstate, chunk + walk, len - walk, &used);
+        if (line)
+            session_line(session, line);
+    }
+
+    session_uncork(session);
+    session_timer(session);
+}
+
+static bool
+session_open(int listener)
+{
+    struct epoll_event event;
+    struct session *session;
+    int fd;
+
+    fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    session = calloc(1, sizeof(*session));
+    if (!session) {
+        close(fd);
+        return true;
+    }
+
+    session->fd = fd;
+    session->rstate = bfrl_pool_get(server_pool, session_read, session_write, session);
+    if (!session->rstate) {
+        free(session);
+        close(fd);
+        return true;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &event)) {
+        bfrl_pool_put(server_pool, session->rstate);
+        free(session);
+        close(fd);
+        return true;
+    }
+
+    ++server_sessions;
+    bfrl_writev_set(session->rstate, session_writev);
+    bfrl_resize(session->rstate, 80, 24);
+    bfrl_start(session->rstate, "# ", "> ");
+
+    return true;
+}
+
+static int
+server_timeout(void)
+{
+    struct session *session;
+    uint64_t now, first;
+
+    if (bfdev_list_check_empty(&server_pending))
+        return -1;
+
+    now = server_clock();
+    first = UINT64_MAX;
+    bfdev_list_for_each_entry(session, &server_pending, pending) {
+        if (session->deadline < first)
+            first = session->deadline;
+    }
+
+    return first > now ? first - now : 0;
+}
+
+static void
+server_expire(void)
+{
+    struct session *session, *tmp;
+    const char *line;
+    uint64_t now;
+
+    now = server_clock();
+    bfdev_list_for_each_entry_safe(session, tmp, &server_pending, pending) {
+        if (session->deadline > now)
+            continue;
+
+        bfdev_list_del(&session->pending);
+        session->waiting = false;
+
+        session_cork(session);
+        line = bfrl_expire(session->rstate);
+        if (line)
+            session_line(session, line);
+        session_uncork(session);
+
+        if (session->closing)
+            session_close(session);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct epoll_event events[SERVER_EVENTS];
+    struct sockaddr_un addr = {};
+    const char *path = SERVER_PATH;
+    struct session *session;
+    int listener, count, index;
+
+    if (argc > 1)
+        path = argv[1];
+
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        err(errno, "socket");
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)))
+        err(errno, "bind");
+
+    if (listen(listener, SOMAXCONN))
+        err(errno, "listen");
+
+    /* Connection churn reuses warmed up states */
+    server_pool = bfrl_pool_create(NULL, SERVER_POOL);
+    if (!server_pool)
+        err(ENOMEM, "bfrl_pool_create");
+
+    server_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (server_epoll < 0)
+        err(errno, "epoll_create1");
+
+    events[0].events = EPOLLIN;
+    events[0].data.ptr = NULL;
+    if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, listener, &events[0]))
+        err(errno, "epoll_ctl");
+
+    server_baseline = mallinfo2().uordblks;
+    printf("listening on %s\n", path);
+
+    for (;;) {
+        count = epoll_wait(server_epoll, events, SERVER_EVENTS, server_timeout());
+        if (count < 0 && errno != EINTR)
+            err(errno, "epoll_wait");
+
+        for (index = 0; index < count; ++index) {
+            session = events[index].data.ptr;
+            if (!session) {
+                while (session_open(listener));
+                continue;
+            }
+
+            if (events[index].events & (EPOLLERR | EPOLLHUP))
+                session->closing = true;
+            else {
+                if (events[index].events & EPOLLOUT)
+                    session_flush(session);
+                if (events[index].events & EPOLLIN)
+                    session_input(session);
+            }
+
+            if (session->closing)
+                session_close(session);
+        }
+
+        server_expire();
+    }
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BFRL_CORE_H_
+#define _BFRL_CORE_H_
+
+#include <bfrl/readline.h>
+
+#ifndef BFRL_RENDER_DEF
+# define BFRL_RENDER_DEF 256
+#endif
+
+enum bfrl_event {
+    BFRL_EVENT_EDIT     = 1 << 0, /* the line buffer changed */
+    BFRL_EVENT_MOVE     = 1 << 1, /* the cursor moved */
+    BFRL_EVENT_LINE     = 1 << 2, /* a line was accepted */
+    BFRL_EVENT_PENDING  = 1 << 3, /* input stopped inside a sequence */
+};
+
+/*
+ * Outcome of one call. @render holds the terminal output it produced
+ * and @line the accepted line, both valid until the next call.
+ */
+struct bfrl_delta {
+    unsigned int events;
+    unsigned int used;
+    unsigned int pos;
+    unsigned int pending;
+
+    const char *line;
+    unsigned int len;
+
+    const char *render;
+    unsigned int rlen;
+};
+
+/*
+ * Editor without any I/O: bytes go in, events and the output to apply
+ * to the terminal come out. After an accepted line the next call
+ * starts a new one with the same prompts.
+ */
+struct bfrl_core {
+    const struct bfdev_alloc *alloc;
+    struct bfrl_state *state;
+    const char *dprompt;
+    const char *cprompt;
+
+    char *render;
+    unsigned int rlen;
+    unsigned int rsize;
+    int error;
+};
+
+extern struct bfrl_core *bfrl_core_create(const struct bfdev_alloc *alloc, unsigned int cols, unsigned int rows);
+extern void bfrl_core_destroy(struct bfrl_core *core);
+extern int bfrl_core_start(struct bfrl_core *core, const char *dprompt, const char *cprompt, struct bfrl_delta *delta);
+extern int bfrl_core_feed(struct bfrl_core *core, const char *str, unsigned int len, struct bfrl_delta *delta);
+extern int bfrl_core_expire(struct bfrl_core *core, struct bfrl_delta *delta);
+extern int bfrl_core_resize(struct bfrl_core *core, unsigned int cols, unsigned int rows, struct bfrl_delta *delta);
+
+#endif /* _BFRL_CORE_H_ */
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BFRL_PERSIST_H_
+#define _BFRL_PERSIST_H_
+
+#include <bfrl/readline.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifndef BFRL_PERSIST_DEF
+# define BFRL_PERSIST_DEF 4096
+#endif
+
+#ifndef BFRL_PERSIST_COMPACT_DEF
+# define BFRL_PERSIST_COMPACT_DEF 65536
+#endif
+
+#ifndef BFRL_PERSIST_KEEP
+# define BFRL_PERSIST_KEEP 4096
+#endif
+
+/* What a commit does when the queue is full */
+enum bfrl_persist_policy {
+    BFRL_PERSIST_DROP = 0,
+    BFRL_PERSIST_BLOCK,
+};
+
+/*
+ * History file backend. Committed lines go through a single producer,
+ * single consumer ring to a worker thread, which appends every batch
+ * with one write and one fdatasync, and rewrites the file without
+ * duplicates once it has doubled. One line per entry, with '\' and
+ * newline escaped as "\\" and "\n". The worker allocates from @alloc
+ * while it compacts, alongside the caller, so @alloc has to be safe
+ * to use from several threads.
+ */
+struct bfrl_persist {
+    const struct bfdev_alloc *alloc;
+    struct bfrl_state *state;
+    enum bfrl_persist_policy policy;
+
+    char *path;
+    char *tpath;
+    char *dpath;
+    int fd;
+    size_t fsize;
+    size_t limit;
+
+    char *ring;
+    size_t mask;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_bool sleeping;
+    atomic_bool stop;
+    atomic_ulong dropped;
+    atomic_int error;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t space;
+};
+
+extern struct bfrl_persist *bfrl_persist_start(const struct bfdev_alloc *alloc, struct bfrl_state *state, const char *path, unsigned int size, enum bfrl_persist_policy policy);
+extern int bfrl_persist_stop(struct bfrl_persist *persist);
+extern int bfrl_persist_commit(struct bfrl_persist *persist, const char *cmd, unsigned int len);
+
+#endif /* _BFRL_PERSIST_H_ */
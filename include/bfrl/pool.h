@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BFRL_POOL_H_
+#define _BFRL_POOL_H_
+
+#include <bfrl/readline.h>
+
+/*
+ * Recycles released states together with their buffers. A pool has
+ * no locking, use one per thread.
+ */
+struct bfrl_pool {
+    const struct bfdev_alloc *alloc;
+    struct bfdev_list_head states;
+    unsigned int count;
+    unsigned int max;
+};
+
+extern struct bfrl_pool *bfrl_pool_create(const struct bfdev_alloc *alloc, unsigned int max);
+extern void bfrl_pool_destroy(struct bfrl_pool *pool);
+extern struct bfrl_state *bfrl_pool_get(struct bfrl_pool *pool, bfrl_read_t read, bfrl_write_t write, void *data);
+extern void bfrl_pool_put(struct bfrl_pool *pool, struct bfrl_state *state);
+
+#endif /* _BFRL_POOL_H_ */
@@ -23,8 +23,83 @@
 # define BFRL_CLIPBRD_DEF 64
 #endif
 
+#ifndef BFRL_LAYOUT_DEF
+# define BFRL_LAYOUT_DEF 8
+#endif
+
+#ifndef BFRL_ESC_TIMEOUT_DEF
+# define BFRL_ESC_TIMEOUT_DEF 25
+#endif
+
+#ifndef BFRL_WORDCHARS_MAX
+# define BFRL_WORDCHARS_MAX 8
+#endif
+
+#ifndef BFRL_IOVEC_MAX
+# define BFRL_IOVEC_MAX 32
+#endif
+
+#ifndef BFRL_SCRATCH_MAX
+# define BFRL_SCRATCH_MAX 64
+#endif
+
+#ifndef BFRL_SPAN_DEF
+# define BFRL_SPAN_DEF 16
+#endif
+
+#ifndef BFRL_PROMPT_DEF
+# define BFRL_PROMPT_DEF 32
+#endif
+
+#ifndef BFRL_SEGMENT_MAX
+# define BFRL_SEGMENT_MAX 8
+#endif
+
+#ifndef BFRL_HISTORY_DECAY
+# define BFRL_HISTORY_DECAY 256
+#endif
+
+#ifndef BFRL_HISTORY_HASH_DEF
+# define BFRL_HISTORY_HASH_DEF 64
+#endif
+
 typedef unsigned int (*bfrl_read_t)(char *str, unsigned int len, void *data);
 typedef void (*bfrl_write_t)(const char *str, unsigned int len, void *data);
+typedef bool (*bfrl_poll_t)(unsigned int timeout, void *data);
+
+/*
+ * Input observer: called once per bfrl_feed with the bytes it took,
+ * after the output they caused, which has @feeding set while it is
+ * written. bfrl_expire calls it with a NULL @str before the timeout
+ * is handled.
+ */
+typedef void (*bfrl_input_t)(const char *str, unsigned int len, void *data);
+
+/* Monotonic time in any unit, e.g. microseconds */
+typedef uint64_t (*bfrl_clock_t)(void *data);
+
+/* Same layout as struct iovec, so it can be passed to writev as is */
+struct bfrl_iovec {
+    const void *base;
+    size_t len;
+};
+
+/*
+ * Vectored output: the pieces point into the prompts, the line buffer
+ * and static strings, they are only valid until the callback returns.
+ */
+typedef void (*bfrl_writev_t)(const struct bfrl_iovec *iov, unsigned int count, void *data);
+
+/*
+ * Highlighter: lex one token of @buff starting at @offset, in the
+ * tokenizer state @tstate (updated to the state after the token).
+ * Returns the token length and sets @style to its SGR parameters,
+ * e.g. "1;31", or leaves it NULL for plain text. A token may only
+ * depend on its own bytes and the incoming state.
+ */
+typedef unsigned int (*bfrl_highlight_t)(const char *buff, unsigned int len,
+                                         unsigned int offset, unsigned int *tstate,
+                                         const char **style, void *data);
 
 enum bfrl_esc {
     BFRL_ESC_NORM = 0,
@@ -33,9 +108,61 @@ enum bfrl_esc {
     BFRL_ESC_SS3,
 };
 
+/*
+ * Recall order of ^P/^N: most recent first, or by frecency, where
+ * a use counts (1 + 1/BFRL_HISTORY_DECAY) times more than the use
+ * one executed line before it.
+ */
+enum bfrl_recall {
+    BFRL_RECALL_RECENT = 0,
+    BFRL_RECALL_FRECENT,
+};
+
+struct bfrl_persist;
+
+struct bfrl_segment {
+    unsigned int offset;
+    unsigned int len;
+    unsigned int width;
+};
+
+/*
+ * Prompt parsed ahead of time: its bytes, made of segments which can
+ * be replaced one by one, and its width on screen, which leaves out
+ * escape sequences such as colors. Update it between lines only.
+ */
+struct bfrl_prompt {
+    const struct bfdev_alloc *alloc;
+    char *buff;
+    unsigned int len;
+    unsigned int size;
+    unsigned int width;
+    struct bfrl_segment segs[BFRL_SEGMENT_MAX];
+    unsigned int nsegs;
+};
+
+struct bfrl_line {
+    unsigned int offset;
+    bool wrap;
+};
+
+struct bfrl_span {
+    unsigned int offset;
+    unsigned int tstate;
+    const char *style;
+};
+
 struct bfrl_history {
     struct bfdev_list_head list;
+    struct bfdev_list_head rank;
+    struct bfrl_history *hnext;
+    unsigned int hash;
+    uint64_t stamp;
+    uint64_t weight;
+    unsigned int count;
+    unsigned int session;
     unsigned int len;
+    unsigned int size;
     char cmd[0];
 };
 
@@ -43,18 +170,60 @@ struct bfrl_state {
     const struct bfdev_alloc *alloc;
     bfrl_read_t read;
     bfrl_write_t write;
+    bfrl_writev_t writev;
+    bfrl_poll_t poll;
+    bfrl_input_t input;
     void *data;
+    bool feeding;
 
     const char *prompt;
     unsigned int plen;
+    unsigned int pwidth;
+    const char *cprompt;
+    unsigned int cplen;
+    unsigned int cpwidth;
 
     char *buff;
     unsigned int len;
     unsigned int pos;
     unsigned int bsize;
+    unsigned long edits;
     bool keylock;
     char esc_param;
     enum bfrl_esc esc_state;
+    unsigned int esc_argv[2];
+    unsigned char esc_argc;
+    unsigned int esc_timeout;
+    char utf8[4];
+    unsigned char utf8_len;
+    unsigned char utf8_need;
+
+    unsigned char wordmap[32];
+    char wordchars[BFRL_WORDCHARS_MAX];
+    unsigned char nwordchars;
+
+    struct bfrl_line *lines;
+    unsigned int nlines;
+    unsigned int lsize;
+    unsigned int row;
+    unsigned int col;
+    unsigned int drawn;
+    bool active;
+
+    unsigned int cols;
+    unsigned int rows;
+    bool probing;
+
+    struct bfrl_iovec iov[BFRL_IOVEC_MAX];
+    unsigned int niov;
+    char scratch[BFRL_SCRATCH_MAX];
+    unsigned int scrlen;
+
+    bfrl_highlight_t highlight;
+    void *hdata;
+    struct bfrl_span *spans;
+    unsigned int nspans;
+    unsigned int ssize;
 
     const char *workspace;
     unsigned int worklen;
@@ -67,10 +236,44 @@ struct bfrl_state {
     bool clipview;
 
     struct bfdev_list_head history;
+    struct bfdev_list_head hcache;
     struct bfrl_history *curr;
+    struct bfdev_list_head hrank;
+    struct bfrl_history **htable;
+    unsigned int hsize;
+    unsigned int hcount;
+    enum bfrl_recall recall;
+    uint64_t hinc;
+    bfrl_clock_t hclock;
+    void *hcdata;
+    unsigned int session;
+    struct bfrl_persist *persist;
+
+    struct bfdev_list_head pool;
 };
 
 extern char *bfrl_readline(struct bfrl_state *state, const char *dprompt, const char *cprompt);
+extern void bfrl_start(struct bfrl_state *state, const char *dprompt, const char *cprompt);
+extern char *bfrl_readline_prompt(struct bfrl_state *state, const struct bfrl_prompt *dprompt, const struct bfrl_prompt *cprompt);
+extern void bfrl_start_prompt(struct bfrl_state *state, const struct bfrl_prompt *dprompt, const struct bfrl_prompt *cprompt);
+extern char *bfrl_feed(struct bfrl_state *state, const char *str, unsigned int len, unsigned int *used);
+extern unsigned int bfrl_pending(struct bfrl_state *state);
+extern char *bfrl_expire(struct bfrl_state *state);
+extern void bfrl_poll_set(struct bfrl_state *state, bfrl_poll_t poll, unsigned int timeout);
+extern void bfrl_writev_set(struct bfrl_state *state, bfrl_writev_t writev);
+extern int bfrl_resize(struct bfrl_state *state, unsigned int cols, unsigned int rows);
+extern void bfrl_probe(struct bfrl_state *state);
+extern int bfrl_highlight_set(struct bfrl_state *state, bfrl_highlight_t highlight, void *data);
+extern int bfrl_wordchars_set(struct bfrl_state *state, const char *chars);
+extern void bfrl_recall_set(struct bfrl_state *state, enum bfrl_recall recall);
+extern void bfrl_history_clock_set(struct bfrl_state *state, bfrl_clock_t clock, void *data);
+extern void bfrl_session_set(struct bfrl_state *state, unsigned int session);
+extern int bfrl_history_add(struct bfrl_state *state, const char *cmd, unsigned int len);
+extern const struct bfrl_history *bfrl_history_suggest(struct bfrl_state *state, const char *str, unsigned int len);
+extern int bfrl_prompt_update(struct bfrl_prompt *prompt, unsigned int index, const char *str, unsigned int len);
+extern struct bfrl_prompt *bfrl_prompt_alloc(const struct bfdev_alloc *alloc, const char *str);
+extern void bfrl_prompt_free(struct bfrl_prompt *prompt);
+extern void bfrl_reset(struct bfrl_state *state);
 extern struct bfrl_state *bfrl_alloc(const struct bfdev_alloc *alloc, bfrl_read_t read, bfrl_write_t write, void *data);
 extern void bfrl_free(struct bfrl_state *state);
 
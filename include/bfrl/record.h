@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _BFRL_RECORD_H_
+#define _BFRL_RECORD_H_
+
+#include <bfrl/readline.h>
+
+#ifndef BFRL_RECORD_DEF
+# define BFRL_RECORD_DEF 256
+#endif
+
+#define BFRL_RECORD_MAGIC "bfrl"
+#define BFRL_RECORD_VERSION 1
+
+/*
+ * Log layout: magic, version, then the terminal columns and rows as
+ * varints, followed by records of one type byte, the varint time since
+ * the previous record, the varint length and the payload. Consecutive
+ * writes are merged into one record stamped with the first of them,
+ * and so are reads that caused no output in between.
+ */
+enum bfrl_record_type {
+    BFRL_RECORD_READ = 0,
+    BFRL_RECORD_WRITE,
+    BFRL_RECORD_EXPIRE,
+    BFRL_RECORD_RESIZE,
+};
+
+struct bfrl_record {
+    const struct bfdev_alloc *alloc;
+    struct bfrl_state *state;
+
+    bfrl_read_t read;
+    bfrl_write_t write;
+    bfrl_writev_t writev;
+    bfrl_poll_t poll;
+    bfrl_input_t input;
+    void *odata;
+
+    bfrl_write_t sink;
+    bfrl_clock_t clock;
+    void *data;
+
+    uint64_t stamp;
+    uint64_t wstamp;
+    unsigned int cols;
+    unsigned int rows;
+
+    char *buff;
+    unsigned int blen;
+    unsigned int bsize;
+    bool pending;
+
+    char *ibuff;
+    unsigned int ilen;
+    unsigned int isize;
+    uint64_t istamp;
+    uint64_t fstamp;
+    bool feeding;
+};
+
+/*
+ * Replay statistics. With a @budget, every input event that takes
+ * longer than that in @clock units counts as an @overrun, and
+ * @slowest is the index of the slowest event.
+ */
+struct bfrl_replay {
+    bfrl_clock_t clock;
+    void *data;
+    uint64_t budget;
+
+    unsigned long input;
+    unsigned long output;
+    unsigned long expect;
+    unsigned long events;
+    unsigned long lines;
+    unsigned long mismatch;
+    unsigned long overrun;
+    unsigned long slowest;
+    uint64_t latency_max;
+    uint64_t latency_total;
+};
+
+extern struct bfrl_record *bfrl_record_start(const struct bfdev_alloc *alloc, struct bfrl_state *state, bfrl_write_t sink, bfrl_clock_t clock, void *data);
+extern void bfrl_record_stop(struct bfrl_record *record);
+extern int bfrl_replay(struct bfrl_state *state, struct bfrl_replay *replay, const char *dprompt, const char *cprompt, const void *log, unsigned long len);
+
+#endif /* _BFRL_RECORD_H_ */
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <bfrl/core.h>
+#include <bfdev/string.h>
+#include <export.h>
+
+static unsigned int
+core_read(char *str, unsigned int len, void *data)
+{
+    /* Input only arrives through bfrl_core_feed */
+    return 0;
+}
+
+static void
+core_write(const char *str, unsigned int len, void *data)
+{
+    struct bfrl_core *core = data;
+    unsigned int nsize;
+    char *nblk;
+
+    if (core->rlen + len > core->rsize) {
+        for (nsize = core->rsize; nsize < core->rlen + len; nsize *= 2);
+        nblk = bfdev_realloc(core->alloc, core->render, nsize);
+        if (!nblk) {
+            core->error = -BFDEV_ENOMEM;
+            return;
+        }
+
+        core->render = nblk;
+        core->rsize = nsize;
+    }
+
+    memcpy(core->render + core->rlen, str, len);
+    core->rlen += len;
+}
+
+/* Start over with an empty delta, and a new line after an accepted one */
+static void
+core_prepare(struct bfrl_core *core)
+{
+    core->rlen = 0;
+    core->error = -BFDEV_ENOERR;
+
+    if (!core->state->active)
+        bfrl_start(core->state, core->dprompt, core->cprompt);
+}
+
+static int
+core_finish(struct bfrl_core *core, struct bfrl_delta *delta, const char *line,
+            unsigned long edits, unsigned int pos)
+{
+    struct bfrl_state *state = core->state;
+
+    delta->events = 0;
+    if (state->edits != edits)
+        delta->events |= BFRL_EVENT_EDIT;
+    if (state->pos != pos)
+        delta->events |= BFRL_EVENT_MOVE;
+
+    delta->line = line;
+    delta->len = line ? state->len : 0;
+    if (line)
+        delta->events |= BFRL_EVENT_LINE;
+
+    delta->pending = bfrl_pending(state);
+    if (delta->pending)
+        delta->events |= BFRL_EVENT_PENDING;
+
+    delta->pos = state->pos;
+    delta->render = core->render;
+    delta->rlen = core->rlen;
+
+    return core->error;
+}
+
+/*
+ * Feed @len bytes, stopping behind an accepted line. @delta->used
+ * tells how much of @str was consumed.
+ */
+int
+bfrl_core_feed(struct bfrl_core *core, const char *str, unsigned int len,
+               struct bfrl_delta *delta)
+{
+    struct bfrl_state *state = core->state;
+    unsigned long edits;
+    unsigned int pos;
+    const char *line;
+
+    core_prepare(core);
+    edits = state->edits;
+    pos = state->pos;
+
+    line = bfrl_feed(state, str, len, &delta->used);
+    return core_finish(core, delta, line, edits, pos);
+}
+
+/* The timeout announced by BFRL_EVENT_PENDING has passed */
+int
+bfrl_core_expire(struct bfrl_core *core, struct bfrl_delta *delta)
+{
+    struct bfrl_state *state = core->state;
+    unsigned long edits;
+    unsigned int pos;
+    const char *line;
+
+    core_prepare(core);
+    edits = state->edits;
+    pos = state->pos;
+
+    line = bfrl_expire(state);
+    delta->used = 0;
+
+    return core_finish(core, delta, line, edits, pos);
+}
+
+int
+bfrl_core_resize(struct bfrl_core *core, unsigned int cols, unsigned int rows,
+                 struct bfrl_delta *delta)
+{
+    struct bfrl_state *state = core->state;
+    unsigned long edits;
+    unsigned int pos;
+    int retval;
+
+    core_prepare(core);
+    edits = state->edits;
+    pos = state->pos;
+
+    retval = bfrl_resize(state, cols, rows);
+    delta->used = 0;
+
+    if (retval)
+        core->error = retval;
+
+    return core_finish(core, delta, NULL, edits, pos);
+}
+
+int
+bfrl_core_start(struct bfrl_core *core, const char *dprompt,
+                const char *cprompt, struct bfrl_delta *delta)
+{
+    struct bfrl_state *state = core->state;
+
+    core->dprompt = dprompt;
+    core->cprompt = cprompt;
+    core->rlen = 0;
+    core->error = -BFDEV_ENOERR;
+
+    bfrl_start(state, dprompt, cprompt);
+    delta->used = 0;
+
+    return core_finish(core, delta, NULL, state->edits, state->pos);
+}
+
+struct bfrl_core *
+bfrl_core_create(const struct bfdev_alloc *alloc, unsigned int cols,
+                 unsigned int rows)
+{
+    struct bfrl_core *core;
+
+    core = bfdev_zalloc(alloc, sizeof(*core));
+    if (!core)
+        return NULL;
+
+    core->alloc = alloc;
+    core->rsize = BFRL_RENDER_DEF;
+    core->render = bfdev_malloc(alloc, core->rsize);
+    if (!core->render)
+        goto failed;
+
+    core->state = bfrl_alloc(alloc, core_read, core_write, core);
+    if (!core->state)
+        goto failed;
+
+    bfrl_resize(core->state, cols, rows);
+    return core;
+
+failed:
+    bfdev_free(alloc, core->render);
+    bfdev_free(alloc, core);
+    return NULL;
+}
+
+void
+bfrl_core_destroy(struct bfrl_core *core)
+{
+    bfrl_free(core->state);
+    bfdev_free(core->alloc, core->render);
+    bfdev_free(core->alloc, core);
+}
@@ -5,79 +5,244 @@
 
 #ifdef _BFRL_READLINE_
 
-static inline void
-cursor_save(struct bfrl_state *rstate)
+static void
+cursor_move(struct bfrl_state *rstate, unsigned int count, char dir)
 {
-    readline_write(rstate, "\e[s", 3);
+    char sequence[16];
+    unsigned int index;
+
+    if (!count)
+        return;
+
+    if (count == 1) {
+        sequence[0] = '\e';
+        sequence[1] = '[';
+        sequence[2] = dir;
+        readline_scratch(rstate, sequence, 3);
+        return;
+    }
+
+    index = sizeof(sequence);
+    sequence[--index] = dir;
+    for (; count; count /= 10)
+        sequence[--index] = '0' + count % 10;
+    sequence[--index] = '[';
+    sequence[--index] = '\e';
+
+    readline_scratch(rstate, sequence + index, sizeof(sequence) - index);
 }
 
-static inline void
-cursor_restore(struct bfrl_state *rstate)
+/*
+ * Move the terminal cursor to @row and @col of the editing area.
+ * Rows that were never drawn don't exist on screen yet, so they are
+ * created with newlines, which scroll the terminal when needed.
+ */
+static void
+cursor_goto(struct bfrl_state *rstate, unsigned int row, unsigned int col)
+{
+    /* Pending wrap at the right margin */
+    if (rstate->cols && rstate->col >= rstate->cols) {
+        readline_write(rstate, "\r", 1);
+        rstate->col = 0;
+    }
+
+    if (row < rstate->row)
+        cursor_move(rstate, rstate->row - row, 'A');
+    else if (row > rstate->row) {
+        if (rstate->row + 1 < rstate->drawn)
+            cursor_move(rstate, bfdev_min(row, rstate->drawn - 1) - rstate->row, 'B');
+
+        if (row >= rstate->drawn) {
+            for (; rstate->drawn <= row; ++rstate->drawn)
+                readline_write(rstate, "\r\n", 2);
+            rstate->col = 0;
+        }
+    }
+
+    if (!col && rstate->col)
+        readline_write(rstate, "\r", 1);
+    else if (col < rstate->col)
+        cursor_move(rstate, rstate->col - col, 'D');
+    else
+        cursor_move(rstate, col - rstate->col, 'C');
+
+    rstate->row = row;
+    rstate->col = col;
+}
+
+static bool
+cursor_offset(struct bfrl_state *rstate, unsigned int offset)
 {
-    readline_write(rstate, "\e[u", 3);
+    unsigned int row, col;
+
+    if (offset > rstate->len)
+        return false;
+
+    row = layout_find(rstate, offset);
+    if (row == rstate->row && rstate->pos >= rstate->lines[row].offset &&
+        rstate->pos <= layout_end(rstate, row)) {
+        if (rstate->pos > offset)
+            col = rstate->col - utf8_width(rstate->buff + offset,
+                                           rstate->pos - offset);
+        else
+            col = rstate->col + utf8_width(rstate->buff + rstate->pos,
+                                           offset - rstate->pos);
+    } else
+        layout_locate(rstate, offset, &row, &col);
+
+    cursor_goto(rstate, row, col);
+    rstate->pos = offset;
+
+    return true;
 }
 
 static bool
 cursor_left(struct bfrl_state *rstate)
 {
-    if (rstate->pos) {
-        readline_write(rstate, "\e[D", 3);
-        --rstate->pos;
-        return true;
-    }
+    if (!rstate->pos)
+        return false;
 
-    return false;
+    return cursor_offset(rstate, utf8_prev(rstate->buff, rstate->pos));
 }
 
 static bool
 cursor_right(struct bfrl_state *rstate)
 {
-    if (rstate->pos < rstate->len) {
-        readline_write(rstate, "\e[C", 3);
-        ++rstate->pos;
-        return true;
-    }
+    if (rstate->pos >= rstate->len)
+        return false;
 
-    return false;
+    return cursor_offset(rstate, utf8_next(rstate->buff,
+                         rstate->len, rstate->pos));
 }
 
 static bool
-cursor_offset(struct bfrl_state *rstate, unsigned int offset)
+cursor_up(struct bfrl_state *rstate)
 {
-    bool retval = true;
+    if (!rstate->row)
+        return false;
 
-    while (rstate->pos != offset && retval) {
-        if (rstate->pos > offset)
-            retval = cursor_left(rstate);
-        else if (rstate->pos < offset)
-            retval = cursor_right(rstate);
-    }
+    return cursor_offset(rstate, layout_seek(rstate,
+                         rstate->row - 1, rstate->col));
+}
 
-    return retval;
+static bool
+cursor_down(struct bfrl_state *rstate)
+{
+    if (rstate->row + 1 >= rstate->nlines)
+        return false;
+
+    return cursor_offset(rstate, layout_seek(rstate,
+                         rstate->row + 1, rstate->col));
 }
 
 static void
 cursor_home(struct bfrl_state *rstate)
 {
-    cursor_offset(rstate, 0);
+    cursor_offset(rstate, layout_home(rstate, rstate->pos));
 }
 
 static void
 cursor_end(struct bfrl_state *rstate)
 {
-    cursor_offset(rstate, rstate->len);
+    cursor_offset(rstate, layout_tail(rstate, rstate->pos));
 }
 
+/*
+ * Redraw from byte @from through the end of row @last. Everything
+ * before @from is still on screen as is. Rows only need clearing when
+ * something may have been drawn past their new end, and @shrink
+ * clears the rows that are no longer part of the layout.
+ */
+static inline void
+readline_text(struct bfrl_state *rstate, unsigned int from, unsigned int end)
+{
+    if (rstate->highlight)
+        highlight_write(rstate, from, end);
+    else
+        readline_write(rstate, rstate->buff + from, end - from);
+}
+
+static void
+readline_paint(struct bfrl_state *rstate, unsigned int from,
+               unsigned int last, bool clear, bool shrink)
+{
+    unsigned int row, col, end, start, tail;
+
+    layout_locate(rstate, from, &row, &col);
+
+    /*
+     * A wide character that doesn't fit wraps early and leaves a gap
+     * at the end of the row above, which still shows what was drawn
+     * there before. Start from that gap so it is cleared as well.
+     */
+    if (clear && row && rstate->lines[row].wrap &&
+        from == rstate->lines[row].offset) {
+        start = rstate->lines[row - 1].offset;
+        tail = layout_column(rstate, row - 1) +
+               utf8_width(rstate->buff + start, from - start);
+        if (tail < rstate->cols) {
+            --row;
+            col = tail;
+        }
+    }
+
+    cursor_goto(rstate, row, col);
+
+    for (;;) {
+        end = layout_end(rstate, row);
+        readline_text(rstate, from, end);
+        col += utf8_width(rstate->buff + from, end - from);
+
+        if (row == last && shrink)
+            readline_write(rstate, "\e[J", 3);
+        else if (clear && (!rstate->cols || col < rstate->cols))
+            readline_write(rstate, "\e[K", 3);
+
+        rstate->row = row;
+        rstate->col = col;
+        rstate->pos = end;
+
+        if (row == last)
+            break;
+
+        readline_write(rstate, "\r\n", 2);
+        from = rstate->lines[++row].offset;
+        col = 0;
+
+        if (row >= rstate->drawn)
+            rstate->drawn = row + 1;
+
+        if (!rstate->lines[row].wrap) {
+            readline_write(rstate, rstate->cprompt, rstate->cplen);
+            col = rstate->cpwidth;
+        }
+    }
+
+    if (shrink)
+        rstate->drawn = rstate->nlines;
+}
+
+/*
+ * Replace @dlen bytes at @offset with @str, then bring the screen
+ * up to date and leave the cursor behind the inserted text.
+ */
 static int
-readline_insert(struct bfrl_state *rstate, const char *str, unsigned int len)
+readline_splice(struct bfrl_state *rstate, unsigned int offset,
+                unsigned int dlen, const char *str, unsigned int ilen)
 {
     const struct bfdev_alloc *alloc = rstate->alloc;
+    unsigned int nlines, last, from, dstart, dend;
+    bool append;
+    int retval;
+
+    bfdev_min_adj(dlen, rstate->len - offset);
+    readline_flush(rstate);
 
-    if (rstate->len + len >= rstate->bsize) {
+    if (rstate->len - dlen + ilen >= rstate->bsize) {
         unsigned int nbsize = rstate->bsize;
         void *nblk;
 
-        while (rstate->len + len >= nbsize)
+        while (rstate->len - dlen + ilen >= nbsize)
             nbsize *= 2;
 
         nblk = bfdev_realloc(alloc, rstate->buff, nbsize);
@@ -88,31 +253,54 @@ readline_insert(struct bfrl_state *rstate, const char *str, unsigned int len)
         rstate->bsize = nbsize;
     }
 
-    memmove(rstate->buff + rstate->pos + len, rstate->buff + rstate->pos, rstate->len - rstate->pos + 1);
-    memmove(rstate->buff + rstate->pos, str, len);
-    rstate->pos += len;
-    rstate->len += len;
+    retval = layout_reserve(rstate, rstate->nlines, str, ilen);
+    if (retval)
+        return retval;
+
+    append = offset == rstate->len;
+    memmove(rstate->buff + offset + ilen, rstate->buff + offset + dlen,
+            rstate->len - offset - dlen);
+    if (ilen)
+        memcpy(rstate->buff + offset, str, ilen);
+    rstate->len = rstate->len - dlen + ilen;
+    ++rstate->edits;
 
-    readline_write(rstate, &rstate->buff[rstate->pos - len], len);
-    cursor_save(rstate);
-    readline_write(rstate, &rstate->buff[rstate->pos], rstate->len - rstate->pos);
-    cursor_restore(rstate);
+#ifdef BFRL_CLIPBRD
+    /* Keep the selection mark on the character it was set on */
+    if (rstate->clippos >= offset + dlen)
+        rstate->clippos = rstate->clippos - dlen + ilen;
+    else if (rstate->clippos > offset)
+        rstate->clippos = offset;
+#endif
+
+    nlines = rstate->nlines;
+    last = layout_update(rstate, offset, dlen, ilen);
+
+    from = offset;
+    if (rstate->highlight &&
+        !highlight_update(rstate, offset, dlen, ilen, &dstart, &dend) &&
+        dstart < dend) {
+        bfdev_min_adj(from, dstart);
+        bfdev_max_adj(last, layout_find(rstate, dend - 1));
+    }
+
+    readline_paint(rstate, from, last, !append, rstate->nlines < nlines);
+    cursor_offset(rstate, offset + ilen);
 
     return -BFDEV_ENOERR;
 }
 
+static int
+readline_insert(struct bfrl_state *rstate, const char *str, unsigned int len)
+{
+    return readline_splice(rstate, rstate->pos, 0, str, len);
+}
+
 static void
 readline_delete(struct bfrl_state *rstate, unsigned int len)
 {
-    bfdev_min_adj(len, rstate->len - rstate->pos);
-
-    memmove(rstate->buff + rstate->pos, rstate->buff + rstate->pos + len, rstate->len - rstate->pos + 1);
-    rstate->len -= len;
-
-    cursor_save(rstate);
-    readline_write(rstate, &rstate->buff[rstate->pos], rstate->len - rstate->pos);
-    readline_fill(rstate, len);
-    cursor_restore(rstate);
+    if (len)
+        readline_splice(rstate, rstate->pos, len, NULL, 0);
 }
 
 static void
@@ -125,6 +313,45 @@ readline_backspace(struct bfrl_state *rstate, unsigned int len)
     readline_delete(rstate, len);
 }
 
+/*
+ * Reflow after the terminal width changed. Rows in front of the first
+ * one that wraps differently are left alone on screen.
+ *
+ * This takes the cursor to be on the same row of the line as before,
+ * which holds on terminals that clip their contents on resize. Ones
+ * that rewrap what is already on screen can move it to another row,
+ * and a line that spans several rows is then redrawn out of place.
+ * bfrl_probe reports the size and not the cursor, so this can't be
+ * told apart; ^L redraws the line on a cleared screen.
+ */
+static int
+readline_reflow(struct bfrl_state *rstate, unsigned int cols)
+{
+    unsigned int first, row, col;
+    int retval;
+
+    rstate->cols = cols;
+    retval = layout_reserve(rstate, 0, rstate->buff, rstate->len);
+    if (retval)
+        return retval;
+
+    /* The terminal may have moved or clipped the cursor column */
+    readline_write(rstate, "\r", 1);
+    rstate->col = 0;
+
+    row = rstate->pos;
+    first = layout_rebuild(rstate);
+    if (first != LAYOUT_NONE)
+        readline_paint(rstate, rstate->lines[first].offset,
+                       rstate->nlines - 1, true, true);
+
+    rstate->pos = row;
+    layout_locate(rstate, rstate->pos, &row, &col);
+    cursor_goto(rstate, row, col);
+
+    return -BFDEV_ENOERR;
+}
+
 static void
 readline_clear(struct bfrl_state *rstate)
 {
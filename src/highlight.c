@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifdef _BFRL_READLINE_
+
+static unsigned int
+highlight_find(struct bfrl_state *rstate, unsigned int offset)
+{
+    unsigned int min, max, mid;
+
+    min = 0;
+    max = rstate->nspans;
+
+    while (max - min > 1) {
+        mid = (min + max) / 2;
+        if (rstate->spans[mid].offset > offset)
+            max = mid;
+        else
+            min = mid;
+    }
+
+    return min;
+}
+
+static inline unsigned int
+highlight_end(struct bfrl_state *rstate, unsigned int index, unsigned int len)
+{
+    if (index + 1 < rstate->nspans)
+        return rstate->spans[index + 1].offset;
+
+    return len;
+}
+
+static unsigned int
+highlight_token(struct bfrl_state *rstate, unsigned int offset,
+                unsigned int *tstate, const char **style)
+{
+    unsigned int len;
+
+    *style = NULL;
+    len = rstate->highlight(rstate->buff, rstate->len, offset,
+                            tstate, style, rstate->hdata);
+    if (!len)
+        len = 1;
+    bfdev_min_adj(len, rstate->len - offset);
+
+    /* Never split a character with escape sequences */
+    offset += len;
+    while (offset < rstate->len && (rstate->buff[offset] & 0xc0) == 0x80)
+        ++offset;
+
+    return offset;
+}
+
+/*
+ * Extend the damage range with the bytes of [@start, @end) in the
+ * old span cache whose style differs from @style. @shift maps old
+ * offsets to the current buffer.
+ */
+static void
+highlight_damage(struct bfrl_state *rstate, unsigned int start,
+                 unsigned int end, unsigned int oldlen, int shift,
+                 const char *style, unsigned int *dstart,
+                 unsigned int *dend)
+{
+    unsigned int index, first, last;
+
+    if (start >= end || !rstate->nspans)
+        return;
+
+    for (index = highlight_find(rstate, start); index < rstate->nspans &&
+         rstate->spans[index].offset < end; ++index) {
+        if (rstate->spans[index].style == style)
+            continue;
+
+        first = bfdev_max(start, rstate->spans[index].offset) + shift;
+        last = bfdev_min(end, highlight_end(rstate, index, oldlen)) + shift;
+
+        bfdev_min_adj(*dstart, first);
+        bfdev_max_adj(*dend, last);
+    }
+}
+
+static int
+highlight_reserve(struct bfrl_state *rstate, unsigned int count)
+{
+    const struct bfdev_alloc *alloc = rstate->alloc;
+    unsigned int nssize;
+    void *nblk;
+
+    if (count <= rstate->ssize)
+        return -BFDEV_ENOERR;
+
+    nssize = rstate->ssize ? rstate->ssize : BFRL_SPAN_DEF;
+    while (nssize < count)
+        nssize *= 2;
+
+    nblk = bfdev_realloc(alloc, rstate->spans, nssize * sizeof(*rstate->spans));
+    if (!nblk)
+        return -BFDEV_ENOMEM;
+
+    rstate->spans = nblk;
+    rstate->ssize = nssize;
+
+    return -BFDEV_ENOERR;
+}
+
+/*
+ * Re-tokenize after @dlen bytes at @offset were replaced by @ilen
+ * bytes. Tokenizing resumes at the span in front of the edit with its
+ * cached tokenizer state and stops as soon as a token starts where an
+ * old one did with the same state, the rest of the cache is shifted.
+ * Returns in [@dstart, @dend) the bytes outside of the edit whose
+ * style changed.
+ */
+static int
+highlight_update(struct bfrl_state *rstate, unsigned int offset,
+                 unsigned int dlen, unsigned int ilen,
+                 unsigned int *dstart, unsigned int *dend)
+{
+    struct bfrl_span *spans = rstate->spans;
+    unsigned int start, count, old, index, oldlen;
+    unsigned int first, ftstate, walk, next, tstate, target;
+    int shift = ilen - dlen;
+    const char *style;
+    int retval;
+
+    *dstart = *dend = offset;
+    oldlen = rstate->len - shift;
+
+    start = walk = tstate = 0;
+    if (rstate->nspans) {
+        start = highlight_find(rstate, offset ? offset - 1 : 0);
+        walk = spans[start].offset;
+        tstate = spans[start].tstate;
+    }
+
+    first = walk;
+    ftstate = tstate;
+
+    /* First pass: count tokens until the cache converges */
+    for (count = 0, old = start; walk < rstate->len; ++count) {
+        if (walk >= offset + ilen) {
+            target = walk - shift;
+            while (old < rstate->nspans && spans[old].offset < target)
+                ++old;
+
+            if (old < rstate->nspans && spans[old].offset == target &&
+                spans[old].tstate == tstate)
+                break;
+        }
+
+        next = highlight_token(rstate, walk, &tstate, &style);
+        if (walk < offset)
+            highlight_damage(rstate, walk, bfdev_min(next, offset),
+                             oldlen, 0, style, dstart, dend);
+        if (next > offset + ilen)
+            highlight_damage(rstate, bfdev_max(walk, offset + ilen) - shift,
+                             next - shift, oldlen, shift, style, dstart, dend);
+        walk = next;
+    }
+
+    if (walk >= rstate->len)
+        old = rstate->nspans;
+
+    retval = highlight_reserve(rstate, rstate->nspans - old + start + count);
+    if (retval) {
+        rstate->nspans = 0;
+        return retval;
+    }
+
+    /* Shift the untouched tail */
+    spans = rstate->spans;
+    memmove(spans + start + count, spans + old,
+            (rstate->nspans - old) * sizeof(*spans));
+    rstate->nspans = rstate->nspans - old + start + count;
+    for (index = start + count; index < rstate->nspans; ++index)
+        spans[index].offset += shift;
+
+    /* Second pass: store the new tokens */
+    walk = first;
+    tstate = ftstate;
+    for (index = start; index < start + count; ++index) {
+        spans[index].offset = walk;
+        spans[index].tstate = tstate;
+        walk = highlight_token(rstate, walk, &tstate, &style);
+        spans[index].style = style;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static void
+highlight_write(struct bfrl_state *rstate, unsigned int from, unsigned int end)
+{
+    unsigned int index, next;
+    const char *style;
+
+    if (!rstate->nspans) {
+        readline_write(rstate, rstate->buff + from, end - from);
+        return;
+    }
+
+    for (index = highlight_find(rstate, from); from < end; ++index) {
+        next = bfdev_min(highlight_end(rstate, index, rstate->len), end);
+        style = rstate->spans[index].style;
+
+        if (style) {
+            readline_write(rstate, "\e[", 2);
+            readline_write(rstate, style, strlen(style));
+            readline_write(rstate, "m", 1);
+        }
+
+        readline_write(rstate, rstate->buff + from, next - from);
+        if (style)
+            readline_write(rstate, "\e[m", 3);
+
+        from = next;
+    }
+}
+
+#endif /* _BFRL_READLINE_ */
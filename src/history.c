@@ -5,6 +5,17 @@
 
 #ifdef _BFRL_READLINE_
 
+#define HISTORY_WEIGHT_UNIT (1ULL << 16)
+#define HISTORY_WEIGHT_LIMIT (1ULL << 48)
+#define HISTORY_WEIGHT_SHIFT 32
+
+static void
+readline_replace(struct bfrl_state *rstate, const char *str, unsigned int len)
+{
+    cursor_offset(rstate, 0);
+    readline_splice(rstate, 0, rstate->len, str, len);
+}
+
 static int
 workspace_save(struct bfrl_state *rstate)
 {
@@ -35,8 +46,45 @@ workspace_save(struct bfrl_state *rstate)
 static void
 workspace_restory(struct bfrl_state *rstate)
 {
-    if (rstate->worklen)
-        readline_insert(rstate, rstate->workspace, rstate->worklen);
+    readline_replace(rstate, rstate->workspace, rstate->worklen);
+}
+
+static inline struct bfdev_list_head *
+history_head(struct bfrl_state *rstate)
+{
+    if (rstate->recall == BFRL_RECALL_FRECENT)
+        return &rstate->hrank;
+    return &rstate->history;
+}
+
+/* Walk the recall order towards older or lower ranked entries */
+static struct bfrl_history *
+history_step(struct bfrl_state *rstate, struct bfrl_history *history, bool older)
+{
+    struct bfdev_list_head *head, *node;
+    bool frecent;
+
+    frecent = rstate->recall == BFRL_RECALL_FRECENT;
+    head = history_head(rstate);
+
+    if (!history)
+        node = head;
+    else
+        node = frecent ? &history->rank : &history->list;
+
+    node = older ? node->next : node->prev;
+    if (node == head)
+        return NULL;
+
+    if (frecent)
+        return bfdev_list_entry(node, struct bfrl_history, rank);
+    return bfdev_list_entry(node, struct bfrl_history, list);
+}
+
+static inline bool
+history_match(const struct bfrl_history *history, const char *str, unsigned int len)
+{
+    return history->len >= len && !memcmp(history->cmd, str, len);
 }
 
 static struct bfrl_history *
@@ -51,36 +99,14 @@ history_prev(struct bfrl_state *rstate, const char *cmd, unsigned int len, bool
             return BFDEV_ERR_PTR(retval);
     }
 
-    if (complete && rstate->worklen) {
-        if (rstate->curr)  {
-            for (prev = bfdev_list_next_entry(rstate->curr, list);
-                 !bfdev_list_entry_check_head(prev, &rstate->history, list);
-                 prev = bfdev_list_next_entry(prev, list)) {
-                if (!strncmp(rstate->workspace, prev->cmd, rstate->worklen))
-                    goto finish;
-            }
-        } else {
-            for (prev = bfdev_list_first_entry(&rstate->history, struct bfrl_history, list);
-                 !bfdev_list_entry_check_head(prev, &rstate->history, list);
-                 prev = bfdev_list_next_entry(prev, list)) {
-                if (!strncmp(rstate->workspace, prev->cmd, rstate->worklen))
-                    goto finish;
-            }
-        }
-        return NULL;
-    }
+    prev = rstate->curr;
+    do
+        prev = history_step(rstate, prev, true);
+    while (prev && complete && !history_match(prev, rstate->workspace, rstate->worklen));
 
-    else if (rstate->curr) {
-        prev = bfdev_list_next_entry(rstate->curr, list);
-        if (bfdev_list_entry_check_head(prev, &rstate->history, list))
-            return NULL;
-    } else {
-        prev = bfdev_list_first_entry_or_null(&rstate->history,
-                    struct bfrl_history, list);
-    }
+    if (prev)
+        rstate->curr = prev;
 
-finish:
-    rstate->curr = prev;
     return prev;
 }
 
@@ -92,54 +118,249 @@ history_next(struct bfrl_state *rstate, bool complete)
     if (!rstate->curr)
         return NULL;
 
-    if (complete && rstate->worklen) {
-        for (next = bfdev_list_prev_entry(rstate->curr, list);
-             !bfdev_list_entry_check_head(next, &rstate->history, list);
-             next = bfdev_list_prev_entry(next, list)) {
-            if (!strncmp(rstate->workspace, next->cmd, rstate->worklen))
-                goto finish;
+    next = rstate->curr;
+    do
+        next = history_step(rstate, next, false);
+    while (next && complete && !history_match(next, rstate->workspace, rstate->worklen));
+
+    rstate->curr = next;
+    return next;
+}
+
+/* Best ranked entry that extends @str */
+static struct bfrl_history *
+history_suggest(struct bfrl_state *rstate, const char *str, unsigned int len)
+{
+    struct bfrl_history *history;
+
+    bfdev_list_for_each_entry(history, &rstate->hrank, rank) {
+        if (history->len > len && history_match(history, str, len))
+            return history;
+    }
+
+    return NULL;
+}
+
+/*
+ * Every use adds the current increment to the weight of its entry, and
+ * the increment grows by 1/BFRL_HISTORY_DECAY per executed line, so old
+ * uses fade without revisiting every entry. All weights are scaled down
+ * together long before they could overflow, which keeps their order.
+ */
+static void
+history_tick(struct bfrl_state *rstate)
+{
+    struct bfrl_history *history;
+
+    if (!rstate->hinc)
+        rstate->hinc = HISTORY_WEIGHT_UNIT;
+
+    rstate->hinc += rstate->hinc / BFRL_HISTORY_DECAY;
+    if (rstate->hinc < HISTORY_WEIGHT_LIMIT)
+        return;
+
+    rstate->hinc >>= HISTORY_WEIGHT_SHIFT;
+    bfdev_list_for_each_entry(history, &rstate->hrank, rank)
+        history->weight >>= HISTORY_WEIGHT_SHIFT;
+}
+
+/*
+ * Put @history, which is off the rank list, below the entries that
+ * outweigh it. A line just used is near the top, so look from there.
+ */
+static void
+history_rank(struct bfrl_state *rstate, struct bfrl_history *history)
+{
+    struct bfrl_history *walk;
+
+    bfdev_list_for_each_entry(walk, &rstate->hrank, rank) {
+        if (walk->weight <= history->weight)
+            break;
+    }
+
+    bfdev_list_add_prev(&walk->rank, &history->rank);
+}
+
+static inline unsigned int
+history_hash(const char *cmd, unsigned int len)
+{
+    unsigned int hash = 2166136261U;
+
+    while (len--)
+        hash = (hash ^ (unsigned char)*cmd++) * 16777619U;
+
+    return hash;
+}
+
+static struct bfrl_history *
+history_find(struct bfrl_state *rstate, const char *cmd, unsigned int len,
+             unsigned int hash)
+{
+    struct bfrl_history *history;
+
+    history = rstate->htable[hash & (rstate->hsize - 1)];
+    for (; history; history = history->hnext) {
+        if (history->hash == hash && history->len == len &&
+            !memcmp(history->cmd, cmd, len))
+            return history;
+    }
+
+    return NULL;
+}
+
+/* Move the indexed entries into a table of @size buckets */
+static int
+history_table(struct bfrl_state *rstate, unsigned int size)
+{
+    const struct bfdev_alloc *alloc = rstate->alloc;
+    struct bfrl_history **table, *history, *next;
+    unsigned int index;
+
+    table = bfdev_zalloc(alloc, sizeof(*table) * size);
+    if (!table)
+        return -BFDEV_ENOMEM;
+
+    for (index = 0; index < rstate->hsize; ++index) {
+        for (history = rstate->htable[index]; history; history = next) {
+            next = history->hnext;
+            history->hnext = table[history->hash & (size - 1)];
+            table[history->hash & (size - 1)] = history;
         }
-        next = NULL;
-        goto finish;
     }
 
-    else {
-        next = bfdev_list_prev_entry(rstate->curr, list);
-        if (bfdev_list_entry_check_head(next, &rstate->history, list))
-            next = NULL;
+    bfdev_free(alloc, rstate->htable);
+    rstate->htable = table;
+    rstate->hsize = size;
+
+    return -BFDEV_ENOERR;
+}
+
+static void
+history_index(struct bfrl_state *rstate, struct bfrl_history *history)
+{
+    struct bfrl_history **bucket;
+
+    /* A table that can't grow just gets longer chains */
+    if (rstate->hcount >= rstate->hsize)
+        history_table(rstate, rstate->hsize * 2);
+
+    bucket = &rstate->htable[history->hash & (rstate->hsize - 1)];
+    history->hnext = *bucket;
+    *bucket = history;
+    ++rstate->hcount;
+}
+
+static void
+history_unindex(struct bfrl_state *rstate, struct bfrl_history *history)
+{
+    struct bfrl_history **walk;
+
+    walk = &rstate->htable[history->hash & (rstate->hsize - 1)];
+    while (*walk != history)
+        walk = &(*walk)->hnext;
+
+    *walk = history->hnext;
+    --rstate->hcount;
+}
+
+/* Take an entry released by a reset that can hold @len bytes */
+static struct bfrl_history *
+history_cache(struct bfrl_state *rstate, unsigned int len)
+{
+    struct bfrl_history *history;
+
+    bfdev_list_for_each_entry(history, &rstate->hcache, list) {
+        if (history->size >= len) {
+            bfdev_list_del(&history->list);
+            return history;
+        }
     }
 
-finish:
-    rstate->curr = next;
-    return next;
+    return NULL;
 }
 
 static int
 history_add(struct bfrl_state *rstate, const char *cmd, unsigned int len)
 {
     const struct bfdev_alloc *alloc = rstate->alloc;
-    struct bfrl_history *history;
+    struct bfrl_history *history, *prev;
+    unsigned int hash;
 
     if (rstate->worklen)
         rstate->worklen = 0;
 
-    history = bfdev_list_first_entry_or_null(&rstate->history, struct bfrl_history, list);
-    if (history && history->len == len && !strncmp(history->cmd, cmd, len))
-        return -BFDEV_ENOERR;
-
-    history = bfdev_malloc(alloc, sizeof(*history) + len);
-    if (!history)
+    if (!rstate->htable && history_table(rstate, BFRL_HISTORY_HASH_DEF))
         return -BFDEV_ENOMEM;
 
-    history->len = len;
-    bfdev_list_head_init(&history->list);
+    /* Scales the weights down, so before any entry leaves the ranking */
+    history_tick(rstate);
 
-    memcpy(history->cmd, cmd, len);
-    bfdev_list_add(&rstate->history, &history->list);
+    hash = history_hash(cmd, len);
+    prev = history_find(rstate, cmd, len, hash);
+    history = bfdev_list_first_entry_or_null(&rstate->history,
+                                             struct bfrl_history, list);
+
+    /* Repeating the last line only counts another use */
+    if (prev && prev == history)
+        bfdev_list_del(&history->rank);
+    else {
+        history = history_cache(rstate, len);
+        if (!history) {
+            history = bfdev_malloc(alloc, sizeof(*history) + len);
+            if (!history)
+                return -BFDEV_ENOMEM;
+            history->size = len;
+        }
+
+        history->len = len;
+        history->hash = hash;
+        history->count = 0;
+        history->weight = 0;
+        memcpy(history->cmd, cmd, len);
+        bfdev_list_add(&rstate->history, &history->list);
+
+        /*
+         * An older copy of the line stays in the recent order, but
+         * hands its uses on and leaves the ranking to the new one.
+         */
+        if (prev) {
+            history->count = prev->count;
+            history->weight = prev->weight;
+            bfdev_list_del_init(&prev->rank);
+            history_unindex(rstate, prev);
+            if (rstate->curr == prev)
+                rstate->curr = history;
+        }
+
+        history_index(rstate, history);
+    }
+
+    history->stamp = rstate->hclock ? rstate->hclock(rstate->hcdata) : 0;
+    history->session = rstate->session;
+    history->weight += rstate->hinc;
+    ++history->count;
+    history_rank(rstate, history);
+
+#ifdef BFRL_PERSIST
+    if (rstate->persist)
+        bfrl_persist_commit(rstate->persist, cmd, len);
+#endif
 
     return -BFDEV_ENOERR;
 }
 
+static void
+history_reset(struct bfrl_state *rstate)
+{
+    if (rstate->htable)
+        memset(rstate->htable, 0, sizeof(*rstate->htable) * rstate->hsize);
+
+    bfdev_list_head_init(&rstate->hrank);
+    rstate->hcount = 0;
+    rstate->curr = NULL;
+    rstate->hinc = 0;
+}
+
 static void
 history_clear(struct bfrl_state *rstate)
 {
@@ -150,7 +371,34 @@ history_clear(struct bfrl_state *rstate)
         bfdev_free(rstate->alloc, history);
     }
 
-    rstate->curr = NULL;
+    history_reset(rstate);
+}
+
+static void
+history_recycle(struct bfrl_state *rstate)
+{
+    struct bfrl_history *history, *next;
+
+    bfdev_list_for_each_entry_safe(history, next, &rstate->history, list)
+        bfdev_list_move_tail(&rstate->hcache, &history->list);
+
+    history_reset(rstate);
+}
+
+static void
+history_release(struct bfrl_state *rstate)
+{
+    struct bfrl_history *history, *next;
+
+    history_clear(rstate);
+    bfdev_list_for_each_entry_safe(history, next, &rstate->hcache, list) {
+        bfdev_list_del(&history->list);
+        bfdev_free(rstate->alloc, history);
+    }
+
+    bfdev_free(rstate->alloc, rstate->htable);
+    rstate->htable = NULL;
+    rstate->hsize = 0;
 }
 
 #endif /* _BFRL_READLINE_ */
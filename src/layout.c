@@ -0,0 +1,322 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifdef _BFRL_READLINE_
+
+#define LAYOUT_NONE (~0U)
+
+static inline unsigned int
+layout_column(struct bfrl_state *rstate, unsigned int row)
+{
+    if (rstate->lines[row].wrap)
+        return 0;
+
+    return row ? rstate->cpwidth : rstate->pwidth;
+}
+
+/* End of the row text, excluding the newline */
+static inline unsigned int
+layout_end(struct bfrl_state *rstate, unsigned int row)
+{
+    unsigned int end;
+
+    if (row + 1 == rstate->nlines)
+        return rstate->len;
+
+    end = rstate->lines[row + 1].offset;
+    if (!rstate->lines[row + 1].wrap)
+        --end;
+
+    return end;
+}
+
+static unsigned int
+layout_find(struct bfrl_state *rstate, unsigned int offset)
+{
+    unsigned int min, max, mid;
+
+    min = 0;
+    max = rstate->nlines;
+
+    while (max - min > 1) {
+        mid = (min + max) / 2;
+        if (rstate->lines[mid].offset > offset)
+            max = mid;
+        else
+            min = mid;
+    }
+
+    return min;
+}
+
+static void
+layout_locate(struct bfrl_state *rstate, unsigned int offset,
+              unsigned int *row, unsigned int *col)
+{
+    unsigned int start;
+
+    *row = layout_find(rstate, offset);
+    start = rstate->lines[*row].offset;
+    *col = layout_column(rstate, *row) +
+           utf8_width(rstate->buff + start, offset - start);
+}
+
+/* Offset in @row closest to display column @col */
+static unsigned int
+layout_seek(struct bfrl_state *rstate, unsigned int row, unsigned int col)
+{
+    unsigned int offset, end, next, column, width;
+
+    offset = rstate->lines[row].offset;
+    end = layout_end(rstate, row);
+    column = layout_column(rstate, row);
+
+    while (offset < end) {
+        next = utf8_next(rstate->buff, end, offset);
+        width = utf8_width(rstate->buff + offset, next - offset);
+        if (column + width > col)
+            break;
+
+        column += width;
+        offset = next;
+    }
+
+    return offset;
+}
+
+/* Start and end of the logical line around @offset */
+static unsigned int
+layout_home(struct bfrl_state *rstate, unsigned int offset)
+{
+    unsigned int row;
+
+    row = layout_find(rstate, offset);
+    while (rstate->lines[row].wrap)
+        --row;
+
+    return rstate->lines[row].offset;
+}
+
+static unsigned int
+layout_tail(struct bfrl_state *rstate, unsigned int offset)
+{
+    unsigned int row;
+
+    row = layout_find(rstate, offset);
+    while (row + 1 < rstate->nlines && rstate->lines[row + 1].wrap)
+        ++row;
+
+    return layout_end(rstate, row);
+}
+
+/*
+ * Scan one row starting at @offset and display column @column.
+ * Returns where the next row starts and whether it is a soft wrap,
+ * or LAYOUT_NONE if the buffer ends on this row. A row that fills
+ * the terminal exactly is always followed by another (maybe empty)
+ * row, which is where the cursor sits when it reaches the margin.
+ */
+static unsigned int
+layout_break(struct bfrl_state *rstate, unsigned int offset,
+             unsigned int column, bool *wrap)
+{
+    const char *buff = rstate->buff;
+    unsigned int len = rstate->len;
+    unsigned int cols = rstate->cols;
+    unsigned int start = offset;
+    unsigned int span, next, width;
+    const char *newline;
+
+    /* Prompt wider than the terminal */
+    if (cols && column >= cols)
+        column %= cols;
+
+    while (offset < len) {
+        span = len - offset;
+        if (cols)
+            bfdev_min_adj(span, cols - column);
+
+        span = utf8_ascii(buff + offset, span);
+        newline = memchr(buff + offset, '\n', span);
+        if (newline) {
+            *wrap = false;
+            return newline - buff + 1;
+        }
+
+        offset += span;
+        column += span;
+        if (cols && column >= cols)
+            goto wrap;
+
+        if (offset == len)
+            break;
+
+        if (span)
+            continue;
+
+        next = utf8_next(buff, len, offset);
+        width = utf8_width(buff + offset, next - offset);
+        if (cols && column + width > cols && (offset > start || column))
+            goto wrap;
+
+        offset = next;
+        column += width;
+        if (cols && column >= cols)
+            goto wrap;
+    }
+
+    return LAYOUT_NONE;
+
+wrap:
+    *wrap = true;
+    return offset;
+}
+
+/*
+ * Make room for the rows @str can add on top of @base rows: every
+ * newline, and every (cols - 1) / 2 bytes as even a row of wide
+ * characters holds that many, plus the rows around the edit point.
+ */
+static int
+layout_reserve(struct bfrl_state *rstate, unsigned int base,
+               const char *str, unsigned int len)
+{
+    const struct bfdev_alloc *alloc = rstate->alloc;
+    unsigned int count, nlsize;
+    const char *walk, *end;
+    void *nblk;
+
+    count = base + 2;
+    for (walk = str, end = str + len; walk < end; ++walk) {
+        walk = memchr(walk, '\n', end - walk);
+        if (!walk)
+            break;
+        ++count;
+    }
+
+    if (rstate->cols)
+        count += len / bfdev_max(1U, (rstate->cols - 1) / 2);
+
+    if (count <= rstate->lsize)
+        return -BFDEV_ENOERR;
+
+    for (nlsize = rstate->lsize; nlsize < count; nlsize *= 2);
+    nblk = bfdev_realloc(alloc, rstate->lines, nlsize * sizeof(*rstate->lines));
+    if (!nblk)
+        return -BFDEV_ENOMEM;
+
+    rstate->lines = nblk;
+    rstate->lsize = nlsize;
+
+    return -BFDEV_ENOERR;
+}
+
+/*
+ * Relayout after @dlen bytes at @offset were replaced by @ilen bytes.
+ * Rows are rebuilt from the edit point until a row break lines up
+ * with the old layout again, everything after that only shifts.
+ * Returns the last row whose content changed.
+ */
+static unsigned int
+layout_update(struct bfrl_state *rstate, unsigned int offset,
+              unsigned int dlen, unsigned int ilen)
+{
+    struct bfrl_line *lines = rstate->lines;
+    unsigned int start, count, old, index;
+    unsigned int walk, column, next, target;
+    bool wrap;
+
+    start = layout_find(rstate, offset);
+    if (start && lines[start].wrap)
+        --start;
+
+    /* First pass: count rows until the layout converges */
+    walk = lines[start].offset;
+    column = layout_column(rstate, start);
+    old = start + 1;
+
+    for (count = 1;; ++count) {
+        next = layout_break(rstate, walk, column, &wrap);
+        if (next == LAYOUT_NONE) {
+            old = rstate->nlines;
+            break;
+        }
+
+        if (next >= offset + ilen) {
+            target = next - ilen + dlen;
+            while (old < rstate->nlines && lines[old].offset < target)
+                ++old;
+
+            if (old < rstate->nlines && lines[old].offset == target &&
+                lines[old].wrap == wrap)
+                break;
+        }
+
+        walk = next;
+        column = wrap ? 0 : rstate->cpwidth;
+    }
+
+    /* Shift the untouched tail */
+    memmove(lines + start + count, lines + old,
+            (rstate->nlines - old) * sizeof(*lines));
+    for (index = start + count; index < rstate->nlines - old + start + count; ++index)
+        lines[index].offset += ilen - dlen;
+
+    /* Second pass: store the rebuilt rows */
+    for (index = start + 1; index < start + count; ++index) {
+        lines[index].offset = layout_break(rstate, lines[index - 1].offset,
+                                           layout_column(rstate, index - 1), &wrap);
+        lines[index].wrap = wrap;
+    }
+
+    if (count != old - start) {
+        rstate->nlines = rstate->nlines - old + start + count;
+        return rstate->nlines - 1;
+    }
+
+    index = start + count - 1;
+    if (ilen != dlen) {
+        while (index + 1 < rstate->nlines && lines[index + 1].wrap)
+            ++index;
+    }
+
+    return index;
+}
+
+/*
+ * Lay out the whole buffer again, e.g. for a new terminal width.
+ * Returns the first row that differs from the old layout, or
+ * LAYOUT_NONE if none does.
+ */
+static unsigned int
+layout_rebuild(struct bfrl_state *rstate)
+{
+    struct bfrl_line *lines = rstate->lines;
+    unsigned int index, next, first;
+    bool wrap;
+
+    first = LAYOUT_NONE;
+    for (index = 1;; ++index) {
+        next = layout_break(rstate, lines[index - 1].offset,
+                            layout_column(rstate, index - 1), &wrap);
+        if (next == LAYOUT_NONE)
+            break;
+
+        if (first == LAYOUT_NONE && (index >= rstate->nlines ||
+            lines[index].offset != next || lines[index].wrap != wrap))
+            first = index - 1;
+
+        lines[index].offset = next;
+        lines[index].wrap = wrap;
+    }
+
+    if (first == LAYOUT_NONE && index != rstate->nlines)
+        first = index - 1;
+
+    rstate->nlines = index;
+    return first;
+}
+
+#endif /* _BFRL_READLINE_ */
@@ -0,0 +1,518 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <bfrl/persist.h>
+#include <bfdev/string.h>
+#include <bfdev/minmax.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <export.h>
+
+#ifdef BFRL_PERSIST
+
+struct persist_line {
+    const char *str;
+    unsigned int len;
+    size_t index;
+    bool keep;
+};
+
+static unsigned int
+persist_escape_len(const char *cmd, unsigned int len)
+{
+    unsigned int count, index;
+
+    for (count = len + 1, index = 0; index < len; ++index) {
+        if (cmd[index] == '\\' || cmd[index] == '\n')
+            ++count;
+    }
+
+    return count;
+}
+
+static inline void
+persist_putc(struct bfrl_persist *persist, size_t pos, char ch)
+{
+    persist->ring[pos & persist->mask] = ch;
+}
+
+static int
+persist_write(int fd, const char *buff, size_t len)
+{
+    ssize_t retval;
+
+    while (len) {
+        retval = write(fd, buff, len);
+        if (retval < 0)
+            return -BFDEV_EIO;
+
+        buff += retval;
+        len -= retval;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+static int
+persist_read(struct bfrl_persist *persist, char **buffp, size_t *lenp)
+{
+    struct stat st;
+    ssize_t retval;
+    size_t len;
+    char *buff;
+    int fd;
+
+    *buffp = NULL;
+    *lenp = 0;
+
+    fd = open(persist->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -BFDEV_ENOERR;
+
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return -BFDEV_ENOERR;
+    }
+
+    buff = bfdev_malloc(persist->alloc, st.st_size);
+    if (!buff) {
+        close(fd);
+        return -BFDEV_ENOMEM;
+    }
+
+    for (len = 0; len < (size_t)st.st_size; len += retval) {
+        retval = read(fd, buff + len, st.st_size - len);
+        if (retval <= 0)
+            break;
+    }
+
+    close(fd);
+    *buffp = buff;
+    *lenp = len;
+
+    return -BFDEV_ENOERR;
+}
+
+/* Unescape every line in place and add it to the history, oldest first */
+static int
+persist_load(struct bfrl_persist *persist)
+{
+    char *buff, *walk, *end, *line, *dest;
+    size_t len, size;
+    int retval;
+
+    retval = persist_read(persist, &buff, &len);
+    if (retval || !buff)
+        return retval;
+
+    /*
+     * A crash in the middle of an append leaves a line without its
+     * newline. Cut it off, or the next append would run into it.
+     */
+    for (size = len; len && buff[len - 1] != '\n'; --len);
+    if (len != size && truncate(persist->path, len)) {
+        bfdev_free(persist->alloc, buff);
+        return -BFDEV_EIO;
+    }
+
+    persist->fsize = len;
+    for (walk = buff, end = buff + len; walk < end; ++walk) {
+        for (line = dest = walk; walk < end && *walk != '\n'; ++walk) {
+            if (*walk == '\\' && walk + 1 < end && walk[1] != '\n')
+                *dest++ = *++walk == 'n' ? '\n' : *walk;
+            else
+                *dest++ = *walk;
+        }
+
+        if (dest != line)
+            bfrl_history_add(persist->state, line, dest - line);
+    }
+
+    bfdev_free(persist->alloc, buff);
+    return -BFDEV_ENOERR;
+}
+
+static int
+persist_line_cmp(const void *a, const void *b)
+{
+    const struct persist_line *la = a, *lb = b;
+    int retval;
+
+    retval = memcmp(la->str, lb->str, bfdev_min(la->len, lb->len));
+    if (retval)
+        return retval;
+
+    if (la->len != lb->len)
+        return la->len < lb->len ? -1 : 1;
+
+    return la->index < lb->index ? -1 : 1;
+}
+
+/* A rename only lasts once the directory holding it is synced */
+static int
+persist_syncdir(struct bfrl_persist *persist)
+{
+    int retval, fd;
+
+    fd = open(persist->dpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -BFDEV_EIO;
+
+    retval = fsync(fd) ? -BFDEV_EIO : -BFDEV_ENOERR;
+    close(fd);
+
+    return retval;
+}
+
+static int
+persist_rewrite(struct bfrl_persist *persist, struct persist_line *lines,
+                size_t count)
+{
+    size_t index, fsize;
+    int retval, fd;
+
+    fd = open(persist->tpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -BFDEV_EIO;
+
+    for (index = fsize = 0; index < count; ++index) {
+        if (!lines[index].keep)
+            continue;
+
+        retval = persist_write(fd, lines[index].str, lines[index].len + 1);
+        if (retval)
+            goto failed;
+        fsize += lines[index].len + 1;
+    }
+
+    retval = -BFDEV_EIO;
+    if (fdatasync(fd) || rename(persist->tpath, persist->path))
+        goto failed;
+
+    close(persist->fd);
+    persist->fd = fd;
+    persist->fsize = fsize;
+
+    return persist_syncdir(persist);
+
+failed:
+    close(fd);
+    unlink(persist->tpath);
+    return retval;
+}
+
+/*
+ * Keep the last copy of every line and at most BFRL_PERSIST_KEEP
+ * lines, in their original order, then swap the file atomically.
+ */
+static int
+persist_compact(struct bfrl_persist *persist)
+{
+    struct persist_line *lines, *sorted;
+    size_t count, index, kept;
+    char *buff, *walk, *end;
+    size_t len;
+    int retval;
+
+    retval = persist_read(persist, &buff, &len);
+    if (retval || !buff)
+        return retval;
+
+    /* Drop a torn last line */
+    while (len && buff[len - 1] != '\n')
+        --len;
+
+    for (walk = buff, end = buff + len, count = 0; walk < end; ++walk) {
+        if (*walk == '\n')
+            ++count;
+    }
+
+    /* Nothing but a torn line, which goes as well */
+    if (!count) {
+        retval = persist_rewrite(persist, NULL, 0);
+        goto free_buff;
+    }
+
+    retval = -BFDEV_EOVERFLOW;
+    if (count > SIZE_MAX / 2 / sizeof(*lines))
+        goto free_buff;
+
+    /* The lines in file order, then a copy sorted by content */
+    retval = -BFDEV_ENOMEM;
+    lines = bfdev_malloc(persist->alloc, 2 * count * sizeof(*lines));
+    if (!lines)
+        goto free_buff;
+    sorted = lines + count;
+
+    for (walk = buff, index = 0; index < count; ++index) {
+        end = memchr(walk, '\n', buff + len - walk);
+        lines[index].str = walk;
+        lines[index].len = end - walk;
+        lines[index].index = index;
+        lines[index].keep = false;
+        walk = end + 1;
+    }
+
+    memcpy(sorted, lines, count * sizeof(*lines));
+    qsort(sorted, count, sizeof(*sorted), persist_line_cmp);
+
+    for (index = 0; index < count; ++index) {
+        if (index + 1 < count && sorted[index].len == sorted[index + 1].len &&
+            !memcmp(sorted[index].str, sorted[index + 1].str, sorted[index].len))
+            continue;
+        lines[sorted[index].index].keep = true;
+    }
+
+    for (index = count, kept = 0; index--;) {
+        if (lines[index].keep && ++kept > BFRL_PERSIST_KEEP)
+            lines[index].keep = false;
+    }
+
+    retval = persist_rewrite(persist, lines, count);
+    bfdev_free(persist->alloc, lines);
+
+free_buff:
+    bfdev_free(persist->alloc, buff);
+    return retval;
+}
+
+/* Everything queued since the last batch goes out with one sync */
+static void
+persist_drain(struct bfrl_persist *persist, size_t tail, size_t head)
+{
+    size_t start, len, first;
+    int retval;
+
+    start = tail & persist->mask;
+    len = head - tail;
+    first = bfdev_min(len, persist->mask + 1 - start);
+
+    if (!atomic_load(&persist->error)) {
+        retval = persist_write(persist->fd, persist->ring + start, first);
+        if (!retval)
+            retval = persist_write(persist->fd, persist->ring, len - first);
+        if (!retval && fdatasync(persist->fd))
+            retval = -BFDEV_EIO;
+        if (retval)
+            atomic_store(&persist->error, retval);
+        persist->fsize += len;
+    }
+
+    atomic_store_explicit(&persist->tail, head, memory_order_release);
+    pthread_mutex_lock(&persist->lock);
+    pthread_cond_broadcast(&persist->space);
+    pthread_mutex_unlock(&persist->lock);
+
+    if (persist->fsize < persist->limit || atomic_load(&persist->error))
+        return;
+
+    retval = persist_compact(persist);
+    if (retval)
+        atomic_store(&persist->error, retval);
+    persist->limit = bfdev_max(persist->fsize * 2, (size_t)BFRL_PERSIST_COMPACT_DEF);
+}
+
+static void *
+persist_worker(void *data)
+{
+    struct bfrl_persist *persist = data;
+    size_t head, tail;
+    bool stop;
+
+    for (;;) {
+        /* Anything committed before the stop is seen with it */
+        stop = atomic_load(&persist->stop);
+        head = atomic_load_explicit(&persist->head, memory_order_acquire);
+        tail = atomic_load_explicit(&persist->tail, memory_order_relaxed);
+
+        if (head != tail) {
+            persist_drain(persist, tail, head);
+            continue;
+        }
+
+        if (stop)
+            break;
+
+        pthread_mutex_lock(&persist->lock);
+        atomic_store(&persist->sleeping, true);
+        while (!atomic_load(&persist->stop) && atomic_load(&persist->head) == tail)
+            pthread_cond_wait(&persist->wake, &persist->lock);
+        atomic_store(&persist->sleeping, false);
+        pthread_mutex_unlock(&persist->lock);
+    }
+
+    return NULL;
+}
+
+static void
+persist_kick(struct bfrl_persist *persist)
+{
+    pthread_mutex_lock(&persist->lock);
+    pthread_cond_signal(&persist->wake);
+    pthread_mutex_unlock(&persist->lock);
+}
+
+int
+bfrl_persist_commit(struct bfrl_persist *persist, const char *cmd,
+                    unsigned int len)
+{
+    size_t head, tail, need, size;
+    unsigned int index;
+
+    size = persist->mask + 1;
+    need = persist_escape_len(cmd, len);
+    if (need > size)
+        goto dropped;
+
+    head = atomic_load_explicit(&persist->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&persist->tail, memory_order_acquire);
+
+    if (need > size - (head - tail)) {
+        if (persist->policy != BFRL_PERSIST_BLOCK)
+            goto dropped;
+
+        pthread_mutex_lock(&persist->lock);
+        while (need > size - (head - atomic_load(&persist->tail)))
+            pthread_cond_wait(&persist->space, &persist->lock);
+        pthread_mutex_unlock(&persist->lock);
+    }
+
+    for (index = 0; index < len; ++index) {
+        switch (cmd[index]) {
+            case '\\':
+                persist_putc(persist, head++, '\\');
+                persist_putc(persist, head++, '\\');
+                break;
+
+            case '\n':
+                persist_putc(persist, head++, '\\');
+                persist_putc(persist, head++, 'n');
+                break;
+
+            default:
+                persist_putc(persist, head++, cmd[index]);
+                break;
+        }
+    }
+
+    persist_putc(persist, head++, '\n');
+    atomic_store(&persist->head, head);
+
+    /* Only take the lock when the worker may be waiting for us */
+    if (atomic_load(&persist->sleeping))
+        persist_kick(persist);
+
+    return -BFDEV_ENOERR;
+
+dropped:
+    atomic_fetch_add(&persist->dropped, 1);
+    return -BFDEV_ENOSPC;
+}
+
+struct bfrl_persist *
+bfrl_persist_start(const struct bfdev_alloc *alloc, struct bfrl_state *state,
+                   const char *path, unsigned int size,
+                   enum bfrl_persist_policy policy)
+{
+    struct bfrl_persist *persist;
+    size_t plen, dlen, rsize;
+
+    persist = bfdev_zalloc(alloc, sizeof(*persist));
+    if (!persist)
+        return NULL;
+
+    persist->alloc = alloc;
+    persist->state = state;
+    persist->policy = policy;
+    persist->fd = -1;
+
+    for (rsize = 64; rsize < (size ? size : BFRL_PERSIST_DEF); rsize *= 2);
+    persist->mask = rsize - 1;
+    persist->ring = bfdev_malloc(alloc, rsize);
+    if (!persist->ring)
+        goto failed;
+
+    plen = strlen(path);
+    persist->path = bfdev_malloc(alloc, plen * 3 + 8);
+    if (!persist->path)
+        goto failed;
+
+    persist->tpath = persist->path + plen + 1;
+    memcpy(persist->path, path, plen + 1);
+    memcpy(persist->tpath, path, plen);
+    memcpy(persist->tpath + plen, ".tmp", 5);
+
+    /* The directory part, "/" or "." when there is none */
+    persist->dpath = persist->tpath + plen + 5;
+    for (dlen = plen; dlen && path[dlen - 1] != '/'; --dlen);
+    if (dlen > 1)
+        --dlen;
+    memcpy(persist->dpath, dlen ? path : ".", dlen ? dlen : 1);
+    persist->dpath[dlen ? dlen : 1] = '\0';
+
+    if (persist_load(persist))
+        goto failed;
+
+    persist->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (persist->fd < 0)
+        goto failed;
+
+    /* The file loaded so far may already deserve a compaction */
+    persist->limit = bfdev_max(persist->fsize * 2, (size_t)BFRL_PERSIST_COMPACT_DEF);
+
+    pthread_mutex_init(&persist->lock, NULL);
+    pthread_cond_init(&persist->wake, NULL);
+    pthread_cond_init(&persist->space, NULL);
+
+    if (pthread_create(&persist->thread, NULL, persist_worker, persist)) {
+        pthread_cond_destroy(&persist->space);
+        pthread_cond_destroy(&persist->wake);
+        pthread_mutex_destroy(&persist->lock);
+        goto failed;
+    }
+
+    state->persist = persist;
+    return persist;
+
+failed:
+    if (persist->fd >= 0)
+        close(persist->fd);
+    bfdev_free(alloc, persist->path);
+    bfdev_free(alloc, persist->ring);
+    bfdev_free(alloc, persist);
+    return NULL;
+}
+
+/* Waits until every committed line is on disk */
+int
+bfrl_persist_stop(struct bfrl_persist *persist)
+{
+    const struct bfdev_alloc *alloc = persist->alloc;
+    int retval;
+
+    atomic_store(&persist->stop, true);
+    persist_kick(persist);
+    pthread_join(persist->thread, NULL);
+
+    retval = atomic_load(&persist->error);
+    if (persist->state->persist == persist)
+        persist->state->persist = NULL;
+
+    close(persist->fd);
+    pthread_cond_destroy(&persist->space);
+    pthread_cond_destroy(&persist->wake);
+    pthread_mutex_destroy(&persist->lock);
+
+    bfdev_free(alloc, persist->path);
+    bfdev_free(alloc, persist->ring);
+    bfdev_free(alloc, persist);
+
+    return retval;
+}
+
+#endif /* BFRL_PERSIST */
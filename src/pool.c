@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <bfrl/pool.h>
+#include <export.h>
+
+#ifdef BFRL_PERSIST
+# include <bfrl/persist.h>
+#endif
+
+struct bfrl_pool *
+bfrl_pool_create(const struct bfdev_alloc *alloc, unsigned int max)
+{
+    struct bfrl_pool *pool;
+
+    pool = bfdev_zalloc(alloc, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->alloc = alloc;
+    pool->max = max;
+    bfdev_list_head_init(&pool->states);
+
+    return pool;
+}
+
+void
+bfrl_pool_destroy(struct bfrl_pool *pool)
+{
+    struct bfrl_state *state, *next;
+
+    bfdev_list_for_each_entry_safe(state, next, &pool->states, pool) {
+        bfdev_list_del(&state->pool);
+        bfrl_free(state);
+    }
+
+    bfdev_free(pool->alloc, pool);
+}
+
+struct bfrl_state *
+bfrl_pool_get(struct bfrl_pool *pool, bfrl_read_t read,
+              bfrl_write_t write, void *data)
+{
+    struct bfrl_state *state;
+
+    state = bfdev_list_first_entry_or_null(&pool->states,
+                struct bfrl_state, pool);
+    if (!state)
+        return bfrl_alloc(pool->alloc, read, write, data);
+
+    bfdev_list_del_init(&state->pool);
+    --pool->count;
+
+    state->read = read;
+    state->write = write;
+    state->data = data;
+
+    return state;
+}
+
+/* Reset a state to what bfrl_alloc returns, keeping its memory */
+void
+bfrl_pool_put(struct bfrl_pool *pool, struct bfrl_state *state)
+{
+    if (pool->count >= pool->max) {
+        bfrl_free(state);
+        return;
+    }
+
+#ifdef BFRL_PERSIST
+    if (state->persist)
+        bfrl_persist_stop(state->persist);
+#endif
+
+    bfrl_reset(state);
+    bfrl_writev_set(state, NULL);
+    bfrl_poll_set(state, NULL, BFRL_ESC_TIMEOUT_DEF);
+    bfrl_highlight_set(state, NULL, NULL);
+    bfrl_wordchars_set(state, NULL);
+    bfrl_recall_set(state, BFRL_RECALL_RECENT);
+    bfrl_history_clock_set(state, NULL, NULL);
+    bfrl_session_set(state, 0);
+    bfrl_resize(state, 0, 0);
+
+    state->read = NULL;
+    state->write = NULL;
+    state->input = NULL;
+    state->data = NULL;
+    state->prompt = state->cprompt = NULL;
+    state->plen = state->cplen = 0;
+    state->pwidth = state->cpwidth = 0;
+
+    bfdev_list_add(&pool->states, &state->pool);
+    ++pool->count;
+}
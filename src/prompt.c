@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifdef _BFRL_READLINE_
+
+/* Length of the escape sequence at @str, CSI, OSC or two bytes */
+static unsigned int
+prompt_escape(const char *str, unsigned int len)
+{
+    unsigned int index;
+
+    if (len < 2)
+        return len;
+
+    switch (str[1]) {
+        case '[':
+            for (index = 2; index < len; ++index) {
+                if (str[index] >= 0x40 && str[index] <= 0x7e)
+                    return index + 1;
+            }
+            return len;
+
+        case ']':
+            for (index = 2; index < len; ++index) {
+                if (str[index] == BFDEV_ASCII_BEL)
+                    return index + 1;
+                if (str[index] == BFDEV_ASCII_ESC && index + 1 < len &&
+                    str[index + 1] == '\\')
+                    return index + 2;
+            }
+            return len;
+
+        default:
+            return 2;
+    }
+}
+
+/* Columns taken on screen, escape sequences take none */
+static unsigned int
+prompt_width(const char *str, unsigned int len)
+{
+    unsigned int width, walk, start;
+    const char *esc;
+
+    for (width = walk = 0; walk < len;) {
+        start = walk;
+        esc = memchr(str + walk, BFDEV_ASCII_ESC, len - walk);
+        walk = esc ? esc - str : len;
+
+        width += utf8_width(str + start, walk - start);
+        if (walk < len)
+            walk += prompt_escape(str + walk, len - walk);
+    }
+
+    return width;
+}
+
+static int
+prompt_reserve(struct bfrl_prompt *prompt, unsigned int len)
+{
+    unsigned int nsize;
+    char *nblk;
+
+    if (len < prompt->size)
+        return -BFDEV_ENOERR;
+
+    for (nsize = prompt->size; nsize <= len; nsize *= 2);
+    nblk = bfdev_realloc(prompt->alloc, prompt->buff, nsize);
+    if (!nblk)
+        return -BFDEV_ENOMEM;
+
+    prompt->buff = nblk;
+    prompt->size = nsize;
+
+    return -BFDEV_ENOERR;
+}
+
+/*
+ * Replace segment @index, or append it when @index is the segment
+ * count. Only the new text is measured, the rest keeps its width.
+ * A segment must hold whole escape sequences.
+ */
+static int
+prompt_update(struct bfrl_prompt *prompt, unsigned int index,
+              const char *str, unsigned int len)
+{
+    struct bfrl_segment *seg;
+    unsigned int walk, tail, width;
+    int retval;
+
+    if (index > prompt->nsegs)
+        return -BFDEV_EINVAL;
+
+    if (index == BFRL_SEGMENT_MAX)
+        return -BFDEV_EOVERFLOW;
+
+    seg = &prompt->segs[index];
+    if (index == prompt->nsegs) {
+        seg->offset = prompt->len;
+        seg->len = seg->width = 0;
+    } else if (seg->len == len && !memcmp(prompt->buff + seg->offset, str, len))
+        return -BFDEV_ENOERR;
+
+    retval = prompt_reserve(prompt, prompt->len - seg->len + len);
+    if (retval)
+        return retval;
+
+    tail = seg->offset + seg->len;
+    memmove(prompt->buff + seg->offset + len, prompt->buff + tail,
+            prompt->len - tail);
+    memcpy(prompt->buff + seg->offset, str, len);
+
+    for (walk = index + 1; walk < prompt->nsegs; ++walk)
+        prompt->segs[walk].offset += len - seg->len;
+
+    width = prompt_width(str, len);
+    prompt->width += width - seg->width;
+    prompt->len += len - seg->len;
+    prompt->buff[prompt->len] = '\0';
+
+    seg->len = len;
+    seg->width = width;
+    if (index == prompt->nsegs)
+        ++prompt->nsegs;
+
+    return -BFDEV_ENOERR;
+}
+
+#endif /* _BFRL_READLINE_ */
@@ -9,9 +9,15 @@
 #include <bfdev/ascii.h>
 #include <bfdev/errptr.h>
 #include <bfdev/minmax.h>
+#include <bfdev/macro.h>
 #include <export.h>
 
-#define READLINE_ALT_OFFSET 0x80
+#ifdef BFRL_PERSIST
+# include <bfrl/persist.h>
+#endif
+
+/* Alt keys are decoded beyond the unicode range */
+#define READLINE_ALT_OFFSET 0x110000
 
 static inline unsigned int
 readline_read(struct bfrl_state *rstate, char *str, unsigned int len)
@@ -19,10 +25,71 @@ readline_read(struct bfrl_state *rstate, char *str, unsigned int len)
     return rstate->read(str, len, rstate->data);
 }
 
-static inline void
+static void
+readline_flush(struct bfrl_state *rstate)
+{
+    if (!rstate->niov)
+        return;
+
+    rstate->writev(rstate->iov, rstate->niov, rstate->data);
+    rstate->niov = 0;
+    rstate->scrlen = 0;
+}
+
+/*
+ * With a vectored callback output is only queued by reference. The
+ * queue is flushed before the line buffer changes and whenever control
+ * returns to the caller.
+ */
+static void
 readline_write(struct bfrl_state *rstate, const char *str, unsigned int len)
 {
-    rstate->write(str, len, rstate->data);
+    struct bfrl_iovec *iov;
+
+    if (!rstate->writev) {
+        rstate->write(str, len, rstate->data);
+        return;
+    }
+
+    if (!len)
+        return;
+
+    if (rstate->niov) {
+        iov = &rstate->iov[rstate->niov - 1];
+        if ((const char *)iov->base + iov->len == str) {
+            iov->len += len;
+            return;
+        }
+
+        if (rstate->niov == BFRL_IOVEC_MAX)
+            readline_flush(rstate);
+    }
+
+    iov = &rstate->iov[rstate->niov++];
+    iov->base = str;
+    iov->len = len;
+}
+
+/* Output built in a temporary buffer */
+static void
+readline_scratch(struct bfrl_state *rstate, const char *str, unsigned int len)
+{
+    char *copy;
+
+    if (!rstate->writev) {
+        rstate->write(str, len, rstate->data);
+        return;
+    }
+
+    if (rstate->scrlen + len > sizeof(rstate->scratch) ||
+        rstate->niov == BFRL_IOVEC_MAX)
+        readline_flush(rstate);
+
+    copy = rstate->scratch + rstate->scrlen;
+    memcpy(copy, str, len);
+    rstate->scrlen += len;
+
+    readline_write(rstate, copy, len);
 }
 
 static void
@@ -32,31 +99,62 @@ readline_reset(struct bfrl_state *rstate)
     rstate->len = 0;
     rstate->curr = NULL;
     rstate->esc_state = BFRL_ESC_NORM;
-}
+    rstate->utf8_need = 0;
 
-static void
-readline_fill(struct bfrl_state *rstate, unsigned int len)
-{
-    while (len--)
-        readline_write(rstate, " ", 1);
+    rstate->nlines = 1;
+    rstate->lines[0].offset = 0;
+    rstate->lines[0].wrap = false;
+    rstate->nspans = 0;
+
+    rstate->row = 0;
+    rstate->col = rstate->pwidth;
+    rstate->drawn = 1;
 }
 
 #define _BFRL_READLINE_
+#include "utf8.c"
+#include "layout.c"
+#include "highlight.c"
 #include "cursor.c"
-#include "history.c"
-#include "clipbrd.c"
+#include "prompt.c"
+
+#ifdef BFRL_WORDMOVE
+# include "word.c"
+#endif
+
+#ifdef BFRL_HISTORY
+# include "history.c"
+#endif
+
+#ifdef BFRL_CLIPBRD
+# include "clipbrd.c"
+#endif
+
+/* The line changed, history browsing starts over from it */
+static inline void
+readline_modified(struct bfrl_state *state)
+{
+#ifdef BFRL_HISTORY
+    state->curr = NULL;
+#endif
+}
 
 static bool
-readline_handle(struct bfrl_state *state, char code)
+readline_handle(struct bfrl_state *state, unsigned int code)
 {
+#ifdef BFRL_HISTORY
     struct bfrl_history *history;
-    unsigned int tmp;
     bool complete = false;
+#endif
+    unsigned int tmp;
+    char utf8[4];
 
+#ifdef BFRL_KEYLOCK
     if (state->keylock && code != BFDEV_ASCII_DC3)
         return false;
+#endif
 
-    switch ((unsigned char)code) {
+    switch (code) {
         case BFDEV_ASCII_SOH: /* ^A : Cursor Home */
             cursor_home(state);
             break;
@@ -66,16 +164,18 @@ readline_handle(struct bfrl_state *state, char code)
             break;
 
         case BFDEV_ASCII_ETX: /* ^C : Break Readline */
+            cursor_offset(state, state->len);
             state->len = state->pos = 0;
             state->curr = NULL;
             state->clippos = 0;
             return true;
 
         case BFDEV_ASCII_EOT: /* ^D : Delete */
-            if (state->pos < state->len)
-                readline_delete(state, 1);
-            workspace_save(state);
-            state->curr = NULL;
+            if (state->pos < state->len) {
+                tmp = utf8_next(state->buff, state->len, state->pos);
+                readline_delete(state, tmp - state->pos);
+            }
+            readline_modified(state);
             break;
 
         case BFDEV_ASCII_ENQ: /* ^E : Cursor End */
@@ -87,20 +187,19 @@ readline_handle(struct bfrl_state *state, char code)
             break;
 
         case BFDEV_ASCII_BS: /* ^H : Backspace */
-            if (state->pos)
-                readline_backspace(state, 1);
-            workspace_save(state);
-            state->curr = NULL;
+            if (state->pos) {
+                tmp = utf8_prev(state->buff, state->pos);
+                readline_backspace(state, state->pos - tmp);
+            }
+            readline_modified(state);
             break;
 
         case BFDEV_ASCII_LF: /* ^J : Line Feed */
             goto linefeed;
 
         case BFDEV_ASCII_VT: /* ^K : Clear After */
-            if (state->len)
-                readline_delete(state, state->len - state->pos);
-            workspace_save(state);
-            state->curr = NULL;
+            readline_delete(state, layout_tail(state, state->pos) - state->pos);
+            readline_modified(state);
             break;
 
         case BFDEV_ASCII_FF: /* ^L : Form Feed */
@@ -110,58 +209,61 @@ readline_handle(struct bfrl_state *state, char code)
 
         case BFDEV_ASCII_CR: /* ^M : Carriage Return */
         linefeed:
+            cursor_offset(state, state->len);
             state->clippos = 0;
             return true;
 
         case BFDEV_ASCII_SO: /* ^N : History Complete Next */
+            if (cursor_down(state))
+                break;
+#ifdef BFRL_HISTORY
             complete = true;
             goto history_next;
-
-        case BFDEV_ASCII_SI: /* ^O : Clipboard Select */
-            state->clipview = true;
-            state->clippos = state->pos;
+#else
             break;
+#endif
 
         case BFDEV_ASCII_DLE: /* ^P : History Complete Prev */
+            if (cursor_up(state))
+                break;
+#ifdef BFRL_HISTORY
             complete = true;
             goto history_prev;
-
-        case BFDEV_ASCII_DC1: /* ^Q : History Clear */
-            history_clear(state);
+#else
             break;
+#endif
 
-        case BFDEV_ASCII_DC2: /* ^R : Clipboard Clear */
-            state->cliplen = 0;
+        case BFDEV_ASCII_NAK: /* ^U : Clear Before */
+            readline_backspace(state, state->pos - layout_home(state, state->pos));
+            readline_modified(state);
             break;
 
+#ifdef BFRL_KEYLOCK
         case BFDEV_ASCII_DC3: /* ^S : Readline Lock */
             state->keylock ^= true;
             break;
+#endif
+
+#ifdef BFRL_HISTORY
+        case BFDEV_ASCII_DC1: /* ^Q : History Clear */
+            history_clear(state);
+            break;
 
         case BFDEV_ASCII_DC4: /* ^T : Repeat Execution */
             history = history_prev(state, state->buff, state->len, complete);
             if (history) {
-                cursor_home(state);
-                readline_delete(state, state->len);
-                readline_insert(state, history->cmd, history->len);
+                readline_replace(state, history->cmd, history->len);
                 state->clippos = 0;
             }
             goto linefeed;
 
-        case BFDEV_ASCII_NAK: /* ^U : Clear Before */
-            if (state->pos)
-                readline_backspace(state, state->pos);
-            workspace_save(state);
-            state->curr = NULL;
-            break;
-
         case BFDEV_ASCII_SYN: /* ^V : History Next */
         history_next:
+            if (!state->curr)
+                break;
             history = history_next(state, complete);
-            cursor_home(state);
-            readline_delete(state, state->len);
             if (history)
-                readline_insert(state, history->cmd, history->len);
+                readline_replace(state, history->cmd, history->len);
             else
                 workspace_restory(state);
             state->clippos = 0;
@@ -171,19 +273,27 @@ readline_handle(struct bfrl_state *state, char code)
         history_prev:
             history = history_prev(state, state->buff, state->len, complete);
             if (history) {
-                cursor_home(state);
-                readline_delete(state, state->len);
-                readline_insert(state, history->cmd, history->len);
+                readline_replace(state, history->cmd, history->len);
                 state->clippos = 0;
             }
             break;
+#endif
+
+#ifdef BFRL_CLIPBRD
+        case BFDEV_ASCII_SI: /* ^O : Clipboard Select */
+            state->clipview = true;
+            state->clippos = state->pos;
+            break;
+
+        case BFDEV_ASCII_DC2: /* ^R : Clipboard Clear */
+            state->cliplen = 0;
+            break;
 
         case BFDEV_ASCII_CAN: /* ^X : Clipboard Cut */
             clipbrd_save(state, &tmp);
             cursor_offset(state, tmp);
             readline_delete(state, state->cliplen);
-            workspace_save(state);
-            state->curr = NULL;
+            readline_modified(state);
             break;
 
         case BFDEV_ASCII_EM: /* ^Y : Clipboard Yank */
@@ -192,63 +302,39 @@ readline_handle(struct bfrl_state *state, char code)
 
         case BFDEV_ASCII_SUB: /* ^Z : Clipboard Paste */
             clipbrd_restory(state);
-            workspace_save(state);
-            state->curr = NULL;
+            readline_modified(state);
             break;
 
+        case BFDEV_ASCII_ESC: /* ^[ : Clipboard Cancel */
+            state->clipview = false;
+            break;
+#endif
+
+#ifdef BFRL_WORDMOVE
         case READLINE_ALT_OFFSET + 'b': /* ^[b : Backspace Word */
-            for (tmp = state->pos; tmp-- > 1;) {
-                if (isalnum(state->buff[tmp]) &&
-                    !isalnum(state->buff[tmp - 1])) {
-                    readline_backspace(state, state->pos - tmp);
-                    break;
-                }
-            }
-            if (!tmp)
-                readline_backspace(state, state->pos);
+            readline_backspace(state, state->pos - word_prev(state, state->pos));
+            readline_modified(state);
             break;
 
         case READLINE_ALT_OFFSET + 'd': /* ^[d : Delete Word */
-            for (tmp = state->pos; ++tmp < state->len;) {
-                if (isalnum(state->buff[tmp - 1]) &&
-                    !isalnum(state->buff[tmp])) {
-                    readline_delete(state, tmp - state->pos);
-                    break;
-                }
-            }
-            if (tmp == state->len)
-                readline_delete(state, state->len - state->pos);
+            readline_delete(state, word_end(state, state->pos) - state->pos);
+            readline_modified(state);
             break;
 
         case READLINE_ALT_OFFSET + 'l': /* ^[l : Cursor Left Word */
-            for (tmp = state->pos; tmp-- > 1;) {
-                if (isalnum(state->buff[tmp]) &&
-                    !isalnum(state->buff[tmp - 1])) {
-                    cursor_offset(state, tmp);
-                    break;
-                }
-            }
-            if (!tmp)
-                cursor_home(state);
+            cursor_offset(state, word_prev(state, state->pos));
             break;
 
         case READLINE_ALT_OFFSET + 'r': /* ^[r : Cursor Right Word */
-            for (tmp = state->pos; ++tmp < state->len;) {
-                if (!isalnum(state->buff[tmp - 1]) &&
-                    isalnum(state->buff[tmp])) {
-                    cursor_offset(state, tmp);
-                    break;
-                }
-            }
-            if (tmp == state->len)
-                cursor_end(state);
+            cursor_offset(state, word_next(state, state->pos));
             break;
+#endif
 
         default:
-            if (isprint(code)) {
-                readline_insert(state, &code, 1);
-                workspace_save(state);
-                state->curr = NULL;
+            if (utf8_isprint(code)) {
+                tmp = utf8_encode(code, utf8);
+                readline_insert(state, utf8, tmp);
+                readline_modified(state);
             }
     }
 
@@ -256,10 +342,34 @@ readline_handle(struct bfrl_state *state, char code)
 }
 
 static bool
-readline_getcode(struct bfrl_state *state, char *code)
+readline_decode(struct bfrl_state *state, char byte, unsigned int *code)
 {
-    if (!readline_read(state, code, 1))
+    *code = (unsigned char)byte;
+    if (state->utf8_need) {
+        if ((*code & 0xc0) == 0x80) {
+            state->utf8[state->utf8_len++] = byte;
+            if (--state->utf8_need)
+                return false;
+
+            return utf8_decode(state->utf8, state->utf8_len, code) ==
+                   state->utf8_len;
+        }
+
+        /* Truncated sequence */
+        state->utf8_need = 0;
+    }
+
+    if (*code >= 0x80 && (state->esc_state == BFRL_ESC_NORM ||
+                          state->esc_state == BFRL_ESC_ESC)) {
+        state->esc_state = BFRL_ESC_NORM;
+        if (*code < 0xc2 || *code > 0xf4)
+            return false;
+
+        state->utf8[0] = byte;
+        state->utf8_len = 1;
+        state->utf8_need = *code >= 0xf0 ? 3 : *code >= 0xe0 ? 2 : 1;
         return false;
+    }
 
     switch (state->esc_state) {
         case BFRL_ESC_NORM:
@@ -282,6 +392,9 @@ readline_getcode(struct bfrl_state *state, char *code)
                 case '[':
                     state->esc_state = BFRL_ESC_CSI;
                     state->esc_param = 0;
+                    state->esc_argv[0] = 0;
+                    state->esc_argv[1] = 0;
+                    state->esc_argc = 0;
                     break;
 
                 case 'O':
@@ -307,11 +420,16 @@ readline_getcode(struct bfrl_state *state, char *code)
         case BFRL_ESC_CSI:
             if (*code >= '0' && *code <= '9') {
                 state->esc_param = state->esc_param * 10 + (*code - '0');
+                state->esc_argv[state->esc_argc] =
+                    state->esc_argv[state->esc_argc] * 10 + (*code - '0');
                 return false;
             }
 
-            if (*code == ';')
+            if (*code == ';') {
+                if (!state->esc_argc)
+                    state->esc_argc = 1;
                 break;
+            }
 
             state->esc_state = BFRL_ESC_NORM;
             switch (*code) {
@@ -343,6 +461,14 @@ readline_getcode(struct bfrl_state *state, char *code)
                         *code = READLINE_ALT_OFFSET + 'l';
                     return true;
 
+                case 'R': /* Cursor Position Report */
+                    if (state->probing && state->esc_argc) {
+                        state->probing = false;
+                        bfrl_resize(state, state->esc_argv[1],
+                                    state->esc_argv[0]);
+                    }
+                    break;
+
                 case 'E': /* Cursor Middle */
                     *code = BFDEV_ASCII_DC4;
                     return true;
@@ -430,54 +556,402 @@ readline_getcode(struct bfrl_state *state, char *code)
 }
 
 static inline void
-readline_setup(struct bfrl_state *state, const char *prompt)
+readline_setup(struct bfrl_state *state)
 {
     readline_reset(state);
-    if (!prompt)
-        state->plen = 0;
-    else {
-        state->prompt = prompt;
-        state->plen = strlen(prompt);
-        readline_write(state, state->prompt, state->plen);
+    readline_write(state, state->prompt, state->plen);
+    state->active = true;
+}
+
+/* Drop the escaped newlines joining continuation lines */
+static void
+readline_join(struct bfrl_state *state)
+{
+    unsigned int walk, len;
+
+    for (walk = len = 0; walk < state->len; ++walk) {
+        if (state->buff[walk] == '\\' && walk + 1 < state->len &&
+            state->buff[walk + 1] == '\n')
+            ++walk;
+        else
+            state->buff[len++] = state->buff[walk];
     }
+
+    state->len = len;
 }
 
-char *
-bfrl_readline(struct bfrl_state *state, const char *dprompt, const char *cprompt)
+static bool
+readline_key(struct bfrl_state *state, unsigned int code)
+{
+    if (!readline_handle(state, code))
+        return false;
+
+    if (!state->len || state->buff[state->len - 1] != '\\')
+        return true;
+
+    /* Continuation stays part of the editable statement */
+    readline_insert(state, "\n", 1);
+    return false;
+}
+
+static inline bool
+readline_process(struct bfrl_state *state, char byte)
+{
+    unsigned int code;
+
+    if (!readline_decode(state, byte, &code))
+        return false;
+
+    return readline_key(state, code);
+}
+
+static inline bool
+readline_pending(struct bfrl_state *state)
+{
+    return state->esc_state != BFRL_ESC_NORM || state->utf8_need;
+}
+
+/*
+ * No more input arrived in time: a lone escape is a key of its own,
+ * anything else half received is dropped.
+ */
+static bool
+readline_expire(struct bfrl_state *state)
+{
+    bool escape;
+
+    escape = state->esc_state == BFRL_ESC_ESC;
+    state->esc_state = BFRL_ESC_NORM;
+    state->utf8_need = 0;
+
+    if (!escape)
+        return false;
+
+    return readline_key(state, BFDEV_ASCII_ESC);
+}
+
+static char *
+readline_finish(struct bfrl_state *state)
+{
+    readline_write(state, "\n", 1);
+    readline_flush(state);
+    state->active = false;
+
+    if (state->len) {
+#ifdef BFRL_HISTORY
+        history_add(state, state->buff, state->len);
+#endif
+        readline_join(state);
+    }
+
+    state->buff[state->len] = '\0';
+    return state->buff;
+}
+
+static void
+readline_string(struct bfrl_state *state, const char *dprompt, const char *cprompt)
+{
+    state->prompt = dprompt;
+    state->plen = dprompt ? strlen(dprompt) : 0;
+    state->pwidth = prompt_width(dprompt, state->plen);
+    state->cprompt = cprompt;
+    state->cplen = cprompt ? strlen(cprompt) : 0;
+    state->cpwidth = prompt_width(cprompt, state->cplen);
+}
+
+static void
+readline_prompt(struct bfrl_state *state, const struct bfrl_prompt *dprompt,
+                const struct bfrl_prompt *cprompt)
 {
-    unsigned int offset = 0;
-    char code;
+    state->prompt = dprompt ? dprompt->buff : NULL;
+    state->plen = dprompt ? dprompt->len : 0;
+    state->pwidth = dprompt ? dprompt->width : 0;
+    state->cprompt = cprompt ? cprompt->buff : NULL;
+    state->cplen = cprompt ? cprompt->len : 0;
+    state->cpwidth = cprompt ? cprompt->width : 0;
+}
 
-    readline_setup(state, dprompt);
+static char *
+readline_run(struct bfrl_state *state)
+{
+    char byte;
+
+    readline_setup(state);
 
     for (;;) {
-        if (!readline_getcode(state, &code))
-            ;
+        readline_flush(state);
 
-        else if (readline_handle(state, code)) {
-            readline_write(state, "\n", 1);
-            if (!state->len || state->buff[state->len - 1] != '\\')
+        if (state->poll && readline_pending(state) &&
+            !state->poll(state->esc_timeout, state->data)) {
+            if (readline_expire(state))
                 break;
+        }
 
-            offset += state->len - 1;
-            state->buff += state->len - 1;
-            state->bsize -= state->len - 1;
+        else if (!readline_read(state, &byte, 1))
+            ;
+
+        else if (readline_process(state, byte))
+            break;
+    }
+
+    readline_finish(state);
+    if (!state->len)
+        return NULL;
+
+    return state->buff;
+}
+
+char *
+bfrl_readline(struct bfrl_state *state, const char *dprompt, const char *cprompt)
+{
+    readline_string(state, dprompt, cprompt);
+    return readline_run(state);
+}
+
+char *
+bfrl_readline_prompt(struct bfrl_state *state, const struct bfrl_prompt *dprompt,
+                     const struct bfrl_prompt *cprompt)
+{
+    readline_prompt(state, dprompt, cprompt);
+    return readline_run(state);
+}
 
-            readline_setup(state, cprompt);
+void
+bfrl_start(struct bfrl_state *state, const char *dprompt, const char *cprompt)
+{
+    readline_string(state, dprompt, cprompt);
+    readline_setup(state);
+    readline_flush(state);
+}
+
+void
+bfrl_start_prompt(struct bfrl_state *state, const struct bfrl_prompt *dprompt,
+                  const struct bfrl_prompt *cprompt)
+{
+    readline_prompt(state, dprompt, cprompt);
+    readline_setup(state);
+    readline_flush(state);
+}
+
+char *
+bfrl_feed(struct bfrl_state *state, const char *str,
+          unsigned int len, unsigned int *used)
+{
+    unsigned int index;
+    char *line = NULL;
+
+    state->feeding = true;
+    for (index = 0; index < len;) {
+        if (readline_process(state, str[index++])) {
+            line = readline_finish(state);
+            break;
         }
     }
 
-    state->buff[state->len] = '\0';
-    state->buff -= offset;
-    state->bsize += offset;
-    state->len += offset;
+    if (!line)
+        readline_flush(state);
+    state->feeding = false;
 
-    if (state->len)
-        history_add(state, state->buff, state->len);
-    else
+    if (state->input && index)
+        state->input(str, index, state->data);
+
+    if (used)
+        *used = index;
+
+    return line;
+}
+
+unsigned int
+bfrl_pending(struct bfrl_state *state)
+{
+    if (!readline_pending(state))
+        return 0;
+
+    return state->esc_timeout;
+}
+
+char *
+bfrl_expire(struct bfrl_state *state)
+{
+    if (state->input)
+        state->input(NULL, 0, state->data);
+
+    if (!readline_expire(state)) {
+        readline_flush(state);
         return NULL;
+    }
 
-    return state->buff;
+    return readline_finish(state);
+}
+
+void
+bfrl_poll_set(struct bfrl_state *state, bfrl_poll_t poll, unsigned int timeout)
+{
+    state->poll = poll;
+    if (timeout)
+        state->esc_timeout = timeout;
+}
+
+int
+bfrl_resize(struct bfrl_state *state, unsigned int cols, unsigned int rows)
+{
+    int retval;
+
+    state->rows = rows;
+    if (cols == state->cols)
+        return -BFDEV_ENOERR;
+
+    if (!state->active) {
+        state->cols = cols;
+        return -BFDEV_ENOERR;
+    }
+
+    retval = readline_reflow(state, cols);
+    readline_flush(state);
+
+    return retval;
+}
+
+void
+bfrl_probe(struct bfrl_state *state)
+{
+    /* Park the cursor in the bottom right corner and report it */
+    state->probing = true;
+    readline_write(state, "\e[s\e[999;999H\e[6n\e[u", 20);
+    readline_flush(state);
+}
+
+void
+bfrl_writev_set(struct bfrl_state *state, bfrl_writev_t writev)
+{
+    readline_flush(state);
+    state->writev = writev;
+}
+
+int
+bfrl_highlight_set(struct bfrl_state *state, bfrl_highlight_t highlight,
+                   void *data)
+{
+    unsigned int dstart, dend;
+
+    state->highlight = highlight;
+    state->hdata = data;
+    state->nspans = 0;
+
+    if (!highlight || !state->len)
+        return -BFDEV_ENOERR;
+
+    return highlight_update(state, 0, 0, state->len, &dstart, &dend);
+}
+
+int
+bfrl_wordchars_set(struct bfrl_state *state, const char *chars)
+{
+#ifdef BFRL_WORDMOVE
+    return word_setup(state, chars);
+#else
+    return -BFDEV_ENOTSUP;
+#endif
+}
+
+void
+bfrl_recall_set(struct bfrl_state *state, enum bfrl_recall recall)
+{
+    state->recall = recall;
+    state->curr = NULL;
+}
+
+void
+bfrl_history_clock_set(struct bfrl_state *state, bfrl_clock_t clock, void *data)
+{
+    state->hclock = clock;
+    state->hcdata = data;
+}
+
+void
+bfrl_session_set(struct bfrl_state *state, unsigned int session)
+{
+    state->session = session;
+}
+
+int
+bfrl_history_add(struct bfrl_state *state, const char *cmd, unsigned int len)
+{
+#ifdef BFRL_HISTORY
+    return history_add(state, cmd, len);
+#else
+    return -BFDEV_ENOTSUP;
+#endif
+}
+
+const struct bfrl_history *
+bfrl_history_suggest(struct bfrl_state *state, const char *str, unsigned int len)
+{
+#ifdef BFRL_HISTORY
+    return history_suggest(state, str, len);
+#else
+    return NULL;
+#endif
+}
+
+int
+bfrl_prompt_update(struct bfrl_prompt *prompt, unsigned int index,
+                   const char *str, unsigned int len)
+{
+    return prompt_update(prompt, index, str, len);
+}
+
+struct bfrl_prompt *
+bfrl_prompt_alloc(const struct bfdev_alloc *alloc, const char *str)
+{
+    struct bfrl_prompt *prompt;
+
+    prompt = bfdev_zalloc(alloc, sizeof(*prompt));
+    if (!prompt)
+        return NULL;
+
+    prompt->alloc = alloc;
+    prompt->size = BFRL_PROMPT_DEF;
+    prompt->buff = bfdev_malloc(alloc, prompt->size);
+    if (!prompt->buff)
+        goto failed;
+
+    prompt->buff[0] = '\0';
+    if (str && prompt_update(prompt, 0, str, strlen(str)))
+        goto failed;
+
+    return prompt;
+
+failed:
+    bfdev_free(alloc, prompt->buff);
+    bfdev_free(alloc, prompt);
+    return NULL;
+}
+
+void
+bfrl_prompt_free(struct bfrl_prompt *prompt)
+{
+    bfdev_free(prompt->alloc, prompt->buff);
+    bfdev_free(prompt->alloc, prompt);
+}
+
+void
+bfrl_reset(struct bfrl_state *state)
+{
+    readline_flush(state);
+#ifdef BFRL_HISTORY
+    history_recycle(state);
+#endif
+
+    state->cliplen = 0;
+    state->clippos = 0;
+    state->clipview = false;
+    state->worklen = 0;
+
+    state->keylock = false;
+    state->probing = false;
+    state->active = false;
+    readline_reset(state);
 }
 
 struct bfrl_state *
@@ -490,35 +964,68 @@ bfrl_alloc(const struct bfdev_alloc *alloc, bfrl_read_t read,
     if (!state)
         return NULL;
 
+    state->alloc = alloc;
     state->read = read;
     state->write = write;
     state->data = data;
+    state->esc_timeout = BFRL_ESC_TIMEOUT_DEF;
+#ifdef BFRL_WORDMOVE
+    word_setup(state, NULL);
+#endif
 
     state->bsize = BFRL_BUFFER_DEF;
     state->buff = bfdev_malloc(alloc, state->bsize);
     if (!state->buff)
-        return NULL;
+        goto failed;
 
+#ifdef BFRL_HISTORY
     state->worksize = BFRL_WORKSPACE_DEF;
     state->workspace = bfdev_malloc(alloc, state->worksize);
     if (!state->workspace)
-        return NULL;
+        goto failed;
+#endif
 
+#ifdef BFRL_CLIPBRD
     state->clipsize = BFRL_CLIPBRD_DEF;
     state->clipbrd = bfdev_malloc(alloc, state->clipsize);
     if (!state->clipbrd)
-        return NULL;
+        goto failed;
+#endif
+
+    state->lsize = BFRL_LAYOUT_DEF;
+    state->lines = bfdev_malloc(alloc, state->lsize * sizeof(*state->lines));
+    if (!state->lines)
+        goto failed;
 
     bfdev_list_head_init(&state->history);
+    bfdev_list_head_init(&state->hcache);
+    bfdev_list_head_init(&state->hrank);
+    bfdev_list_head_init(&state->pool);
+
     return state;
+
+failed:
+    bfdev_free(alloc, state->clipbrd);
+    bfdev_free(alloc, state->workspace);
+    bfdev_free(alloc, state->buff);
+    bfdev_free(alloc, state);
+    return NULL;
 }
 
 void
 bfrl_free(struct bfrl_state *state)
 {
-    history_clear(state);
+#ifdef BFRL_PERSIST
+    if (state->persist)
+        bfrl_persist_stop(state->persist);
+#endif
+#ifdef BFRL_HISTORY
+    history_release(state);
+#endif
     bfdev_free(state->alloc, state->workspace);
     bfdev_free(state->alloc, state->clipbrd);
     bfdev_free(state->alloc, state->buff);
+    bfdev_free(state->alloc, state->lines);
+    bfdev_free(state->alloc, state->spans);
     bfdev_free(state->alloc, state);
 }
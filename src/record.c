@@ -0,0 +1,620 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#include <bfrl/record.h>
+#include <bfdev/string.h>
+#include <bfdev/minmax.h>
+#include <export.h>
+
+#define RECORD_MAGIC_LEN (sizeof(BFRL_RECORD_MAGIC) - 1)
+#define RECORD_VARINT_MAX 10
+#define RECORD_NONE (~0UL)
+
+struct record_cursor {
+    const unsigned char *walk;
+    const unsigned char *end;
+};
+
+struct replay_context {
+    struct bfrl_replay *replay;
+    struct record_cursor expect;
+    const unsigned char *wdata;
+    unsigned long wlen;
+};
+
+static unsigned int
+record_varint(char *buff, uint64_t value)
+{
+    unsigned int len;
+
+    for (len = 0; value >= 0x80; value >>= 7)
+        buff[len++] = (value & 0x7f) | 0x80;
+    buff[len++] = value;
+
+    return len;
+}
+
+static inline uint64_t
+record_clock(struct bfrl_record *record)
+{
+    if (!record->clock)
+        return 0;
+
+    return record->clock(record->data);
+}
+
+static void
+record_emit(struct bfrl_record *record, enum bfrl_record_type type,
+            uint64_t stamp, const char *str, unsigned int len)
+{
+    char head[1 + RECORD_VARINT_MAX * 2];
+    unsigned int hlen;
+
+    head[0] = type;
+    hlen = 1;
+    hlen += record_varint(head + hlen, stamp - record->stamp);
+    hlen += record_varint(head + hlen, len);
+    record->stamp = stamp;
+
+    record->sink(head, hlen, record->data);
+    if (len)
+        record->sink(str, len, record->data);
+}
+
+/* Pending input goes out in front of the output it caused */
+static void
+record_flush(struct bfrl_record *record)
+{
+    if (record->ilen) {
+        record_emit(record, BFRL_RECORD_READ, record->istamp,
+                    record->ibuff, record->ilen);
+        record->ilen = 0;
+    }
+
+    if (!record->pending)
+        return;
+
+    record_emit(record, BFRL_RECORD_WRITE, record->wstamp,
+                record->buff, record->blen);
+    record->blen = 0;
+    record->pending = false;
+}
+
+/* Make room for @len more bytes behind @used in a pending buffer */
+static bool
+record_reserve(struct bfrl_record *record, char **buff, unsigned int *size,
+               unsigned int used, unsigned int len)
+{
+    unsigned int nbsize;
+    void *nblk;
+
+    if (used + len <= *size)
+        return true;
+
+    for (nbsize = *size; nbsize < used + len; nbsize *= 2);
+    nblk = bfdev_realloc(record->alloc, *buff, nbsize);
+    if (!nblk)
+        return false;
+
+    *buff = nblk;
+    *size = nbsize;
+
+    return true;
+}
+
+/* Geometry changes are logged in front of whatever they caused */
+static void
+record_geometry(struct bfrl_record *record, uint64_t stamp)
+{
+    struct bfrl_state *state = record->state;
+    char body[RECORD_VARINT_MAX * 2];
+    unsigned int len;
+
+    if (state->cols == record->cols && state->rows == record->rows)
+        return;
+
+    record_flush(record);
+    record->cols = state->cols;
+    record->rows = state->rows;
+
+    len = record_varint(body, record->cols);
+    len += record_varint(body + len, record->rows);
+    record_emit(record, BFRL_RECORD_RESIZE, stamp, body, len);
+}
+
+static void
+record_append(struct bfrl_record *record, const char *str, unsigned int len)
+{
+    if (!record->pending) {
+        record->wstamp = record_clock(record);
+        record->pending = true;
+    }
+
+    if (!record_reserve(record, &record->buff, &record->bsize,
+                        record->blen, len)) {
+        /* Keep the log complete, just less compact */
+        record_flush(record);
+        record_emit(record, BFRL_RECORD_WRITE,
+                    record_clock(record), str, len);
+        return;
+    }
+
+    memcpy(record->buff + record->blen, str, len);
+    record->blen += len;
+}
+
+/*
+ * Reads with no output in between make up one record. Input that
+ * caused output of its own is queued in front of that output.
+ */
+static void
+record_queue(struct bfrl_record *record, const char *str, unsigned int len,
+             uint64_t stamp)
+{
+    if (record->pending && !record->feeding)
+        record_flush(record);
+
+    if (!record->ilen)
+        record->istamp = stamp;
+
+    if (!record_reserve(record, &record->ibuff, &record->isize,
+                        record->ilen, len)) {
+        if (!record->feeding)
+            record_flush(record);
+        record_emit(record, BFRL_RECORD_READ, stamp, str, len);
+        return;
+    }
+
+    memcpy(record->ibuff + record->ilen, str, len);
+    record->ilen += len;
+}
+
+/* Input and timeouts end the output they follow */
+static void
+record_event(struct bfrl_record *record, enum bfrl_record_type type,
+             const char *str, unsigned int len)
+{
+    uint64_t stamp;
+
+    stamp = record_clock(record);
+    record_flush(record);
+    record_geometry(record, stamp);
+    record_emit(record, type, stamp, str, len);
+}
+
+static unsigned int
+record_read(char *str, unsigned int len, void *data)
+{
+    struct bfrl_record *record = data;
+    uint64_t stamp;
+
+    len = record->read(str, len, record->odata);
+    if (!len)
+        return 0;
+
+    stamp = record_clock(record);
+    record_geometry(record, stamp);
+    record_queue(record, str, len, stamp);
+
+    return len;
+}
+
+/*
+ * Output written from inside bfrl_feed follows input that is only
+ * reported once the feed is done. Whatever came before goes out
+ * first, and size changes wait for that input.
+ */
+static void
+record_output(struct bfrl_record *record)
+{
+    struct bfrl_state *state = record->state;
+
+    if (!state->feeding) {
+        record_geometry(record, record_clock(record));
+        return;
+    }
+
+    if (record->feeding)
+        return;
+
+    record_flush(record);
+    record->feeding = true;
+    record->fstamp = record_clock(record);
+}
+
+static void
+record_write(const char *str, unsigned int len, void *data)
+{
+    struct bfrl_record *record = data;
+
+    record_output(record);
+    record->write(str, len, record->odata);
+    record_append(record, str, len);
+}
+
+static void
+record_writev(const struct bfrl_iovec *iov, unsigned int count, void *data)
+{
+    struct bfrl_record *record = data;
+    unsigned int index;
+
+    record_output(record);
+    record->writev(iov, count, record->odata);
+
+    for (index = 0; index < count; ++index)
+        record_append(record, iov[index].base, iov[index].len);
+}
+
+static bool
+record_poll(unsigned int timeout, void *data)
+{
+    struct bfrl_record *record = data;
+
+    if (record->poll(timeout, record->odata))
+        return true;
+
+    record_event(record, BFRL_RECORD_EXPIRE, NULL, 0);
+    return false;
+}
+
+/* Sessions driven by bfrl_feed and bfrl_expire never read or poll */
+static void
+record_input(const char *str, unsigned int len, void *data)
+{
+    struct bfrl_record *record = data;
+
+    if (record->input)
+        record->input(str, len, record->odata);
+
+    if (!str) {
+        record_event(record, BFRL_RECORD_EXPIRE, NULL, 0);
+        return;
+    }
+
+    record_queue(record, str, len, record->feeding ?
+                 record->fstamp : record_clock(record));
+    record->feeding = false;
+    record_geometry(record, record_clock(record));
+}
+
+struct bfrl_record *
+bfrl_record_start(const struct bfdev_alloc *alloc, struct bfrl_state *state,
+                  bfrl_write_t sink, bfrl_clock_t clock, void *data)
+{
+    struct bfrl_record *record;
+    char head[RECORD_MAGIC_LEN + 1 + RECORD_VARINT_MAX * 2];
+    unsigned int hlen;
+
+    record = bfdev_zalloc(alloc, sizeof(*record));
+    if (!record)
+        return NULL;
+
+    record->bsize = BFRL_RECORD_DEF;
+    record->buff = bfdev_malloc(alloc, record->bsize);
+    if (!record->buff)
+        goto free_record;
+
+    record->isize = BFRL_RECORD_DEF;
+    record->ibuff = bfdev_malloc(alloc, record->isize);
+    if (!record->ibuff)
+        goto free_buff;
+
+    record->alloc = alloc;
+    record->state = state;
+    record->sink = sink;
+    record->clock = clock;
+    record->data = data;
+
+    record->read = state->read;
+    record->write = state->write;
+    record->writev = state->writev;
+    record->poll = state->poll;
+    record->input = state->input;
+    record->odata = state->data;
+
+    memcpy(head, BFRL_RECORD_MAGIC, RECORD_MAGIC_LEN);
+    hlen = RECORD_MAGIC_LEN;
+    head[hlen++] = BFRL_RECORD_VERSION;
+    hlen += record_varint(head + hlen, state->cols);
+    hlen += record_varint(head + hlen, state->rows);
+    sink(head, hlen, data);
+
+    record->cols = state->cols;
+    record->rows = state->rows;
+    record->stamp = record_clock(record);
+
+    state->read = record_read;
+    state->write = record_write;
+    if (state->writev)
+        state->writev = record_writev;
+    if (state->poll)
+        state->poll = record_poll;
+    state->input = record_input;
+    state->data = record;
+
+    return record;
+
+free_buff:
+    bfdev_free(alloc, record->buff);
+free_record:
+    bfdev_free(alloc, record);
+    return NULL;
+}
+
+void
+bfrl_record_stop(struct bfrl_record *record)
+{
+    struct bfrl_state *state = record->state;
+
+    record_flush(record);
+
+    state->read = record->read;
+    state->write = record->write;
+    state->writev = record->writev;
+    state->poll = record->poll;
+    state->input = record->input;
+    state->data = record->odata;
+
+    bfdev_free(record->alloc, record->ibuff);
+    bfdev_free(record->alloc, record->buff);
+    bfdev_free(record->alloc, record);
+}
+
+static bool
+record_getvar(struct record_cursor *cursor, uint64_t *value)
+{
+    unsigned int shift;
+
+    for (*value = shift = 0; cursor->walk < cursor->end; shift += 7) {
+        if (shift >= 64)
+            return false;
+
+        *value |= (uint64_t)(*cursor->walk & 0x7f) << shift;
+        if (!(*cursor->walk++ & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+/* Returns the record type, or -BFDEV_EINVAL if it is malformed */
+static int
+record_next(struct record_cursor *cursor, uint64_t *delta,
+            const unsigned char **body, unsigned long *len)
+{
+    uint64_t value;
+    int type;
+
+    type = *cursor->walk++;
+    if (type > BFRL_RECORD_RESIZE)
+        return -BFDEV_EINVAL;
+
+    if (!record_getvar(cursor, delta) || !record_getvar(cursor, &value) ||
+        value > (uint64_t)(cursor->end - cursor->walk))
+        return -BFDEV_EINVAL;
+
+    *body = cursor->walk;
+    *len = value;
+    cursor->walk += value;
+
+    return type;
+}
+
+static inline uint64_t
+replay_clock(struct bfrl_replay *replay)
+{
+    if (!replay->clock)
+        return 0;
+
+    return replay->clock(replay->data);
+}
+
+/* Account the time one input event took since @stamp */
+static void
+replay_latency(struct bfrl_replay *replay, uint64_t stamp)
+{
+    stamp = replay_clock(replay) - stamp;
+    replay->latency_total += stamp;
+
+    if (stamp > replay->latency_max) {
+        replay->latency_max = stamp;
+        replay->slowest = replay->events;
+    }
+
+    if (replay->budget && stamp > replay->budget)
+        ++replay->overrun;
+}
+
+static unsigned int
+replay_read(char *str, unsigned int len, void *data)
+{
+    return 0;
+}
+
+/* Compare the output against the write records of the log */
+static void
+replay_write(const char *str, unsigned int len, void *data)
+{
+    struct replay_context *ctx = data;
+    struct bfrl_replay *replay = ctx->replay;
+    const unsigned char *body;
+    unsigned long size, step;
+    uint64_t delta;
+    int type;
+
+    replay->output += len;
+    while (len && replay->mismatch == RECORD_NONE) {
+        while (!ctx->wlen && ctx->expect.walk < ctx->expect.end) {
+            type = record_next(&ctx->expect, &delta, &body, &size);
+            if (type < 0)
+                ctx->expect.walk = ctx->expect.end;
+            else if (type == BFRL_RECORD_WRITE) {
+                ctx->wdata = body;
+                ctx->wlen = size;
+            }
+        }
+
+        step = bfdev_min((unsigned long)len, ctx->wlen);
+        if (!step || memcmp(str, ctx->wdata, step)) {
+            replay->mismatch = replay->output - len;
+            while (step && *str == *ctx->wdata) {
+                ++replay->mismatch;
+                ++str;
+                ++ctx->wdata;
+                --step;
+            }
+            break;
+        }
+
+        str += step;
+        len -= step;
+        ctx->wdata += step;
+        ctx->wlen -= step;
+    }
+}
+
+static void
+replay_feed(struct bfrl_state *state, struct bfrl_replay *replay,
+            const char *dprompt, const char *cprompt,
+            const unsigned char *body, unsigned long len)
+{
+    unsigned int used;
+    uint64_t stamp;
+
+    while (len) {
+        if (!state->active)
+            bfrl_start(state, dprompt, cprompt);
+
+        stamp = replay_clock(replay);
+        if (bfrl_feed(state, (const char *)body, len, &used))
+            ++replay->lines;
+        replay_latency(replay, stamp);
+
+        body += used;
+        len -= used;
+    }
+}
+
+/*
+ * Feed a recorded session through @state without any terminal. The
+ * input and timeouts are played back as fast as possible and the
+ * output is checked against the recording. Returns -BFDEV_EBADMSG if
+ * it differs, see @replay->mismatch for the first differing byte, or
+ * -BFDEV_ETIMEDOUT if an event went over @replay->budget.
+ */
+int
+bfrl_replay(struct bfrl_state *state, struct bfrl_replay *replay,
+            const char *dprompt, const char *cprompt,
+            const void *log, unsigned long len)
+{
+    bfrl_read_t oread = state->read;
+    bfrl_write_t owrite = state->write;
+    bfrl_writev_t owritev = state->writev;
+    bfrl_poll_t opoll = state->poll;
+    bfrl_input_t oinput = state->input;
+    void *odata = state->data;
+    struct replay_context ctx;
+    struct record_cursor cursor, geometry;
+    const unsigned char *body;
+    uint64_t delta, cols, rows, stamp;
+    unsigned long size;
+    int type, retval;
+
+    cursor.walk = log;
+    cursor.end = cursor.walk + len;
+    if (len < RECORD_MAGIC_LEN + 1 ||
+        memcmp(cursor.walk, BFRL_RECORD_MAGIC, RECORD_MAGIC_LEN) ||
+        cursor.walk[RECORD_MAGIC_LEN] != BFRL_RECORD_VERSION)
+        return -BFDEV_EINVAL;
+
+    cursor.walk += RECORD_MAGIC_LEN + 1;
+    if (!record_getvar(&cursor, &cols) || !record_getvar(&cursor, &rows))
+        return -BFDEV_EINVAL;
+
+    replay->input = replay->output = replay->expect = 0;
+    replay->events = replay->lines = 0;
+    replay->overrun = replay->slowest = 0;
+    replay->latency_max = replay->latency_total = 0;
+    replay->mismatch = RECORD_NONE;
+
+    ctx.replay = replay;
+    ctx.expect = cursor;
+    ctx.wlen = 0;
+
+    state->read = replay_read;
+    state->write = replay_write;
+    state->writev = NULL;
+    state->poll = NULL;
+    state->input = NULL;
+    state->data = &ctx;
+
+    bfrl_resize(state, cols, rows);
+
+    for (retval = -BFDEV_ENOERR; cursor.walk < cursor.end;) {
+        type = record_next(&cursor, &delta, &body, &size);
+        if (type < 0) {
+            retval = type;
+            break;
+        }
+
+        switch (type) {
+            case BFRL_RECORD_READ:
+                replay->input += size;
+                replay_feed(state, replay, dprompt, cprompt, body, size);
+                ++replay->events;
+                break;
+
+            case BFRL_RECORD_WRITE:
+                replay->expect += size;
+                break;
+
+            case BFRL_RECORD_EXPIRE:
+                stamp = replay_clock(replay);
+                if (state->active && bfrl_expire(state))
+                    ++replay->lines;
+                replay_latency(replay, stamp);
+                ++replay->events;
+                break;
+
+            case BFRL_RECORD_RESIZE:
+                geometry.walk = body;
+                geometry.end = body + size;
+                if (!record_getvar(&geometry, &cols) ||
+                    !record_getvar(&geometry, &rows)) {
+                    retval = -BFDEV_EINVAL;
+                    goto finish;
+                }
+
+                /* Already applied if it came from a position report */
+                if (cols != state->cols || rows != state->rows)
+                    bfrl_resize(state, cols, rows);
+                break;
+        }
+    }
+
+    /* A prompt was already shown for the next line */
+    if (!retval && !state->active && replay->output < replay->expect)
+        bfrl_start(state, dprompt, cprompt);
+
+    if (!retval && replay->mismatch == RECORD_NONE &&
+        replay->output != replay->expect)
+        replay->mismatch = bfdev_min(replay->output, replay->expect);
+
+    if (!retval && replay->mismatch != RECORD_NONE)
+        retval = -BFDEV_EBADMSG;
+
+    if (!retval && replay->overrun)
+        retval = -BFDEV_ETIMEDOUT;
+
+finish:
+    state->read = oread;
+    state->write = owrite;
+    state->writev = owritev;
+    state->poll = opoll;
+    state->input = oinput;
+    state->data = odata;
+
+    return retval;
+}
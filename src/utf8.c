@@ -0,0 +1,363 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifdef _BFRL_READLINE_
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#define UTF8_MAX 0x10ffff
+#define UTF8_TABLE(first, last, width) {first, width, last}
+
+struct utf8_range {
+    uint32_t first:22;
+    uint32_t width:2;
+    uint32_t last;
+};
+
+/*
+ * Column width of non-ASCII codepoints, sorted by first codepoint.
+ * Anything not listed here is one column wide.
+ */
+static const struct utf8_range
+utf8_table[] = {
+    UTF8_TABLE(0x00080, 0x0009f, 0), UTF8_TABLE(0x000ad, 0x000ad, 0),
+    UTF8_TABLE(0x00300, 0x0036f, 0), UTF8_TABLE(0x00483, 0x00489, 0),
+    UTF8_TABLE(0x00591, 0x005bd, 0), UTF8_TABLE(0x005bf, 0x005bf, 0),
+    UTF8_TABLE(0x005c1, 0x005c2, 0), UTF8_TABLE(0x005c4, 0x005c5, 0),
+    UTF8_TABLE(0x005c7, 0x005c7, 0), UTF8_TABLE(0x00610, 0x0061a, 0),
+    UTF8_TABLE(0x0064b, 0x0065f, 0), UTF8_TABLE(0x00670, 0x00670, 0),
+    UTF8_TABLE(0x006d6, 0x006dc, 0), UTF8_TABLE(0x006df, 0x006e4, 0),
+    UTF8_TABLE(0x006e7, 0x006e8, 0), UTF8_TABLE(0x006ea, 0x006ed, 0),
+    UTF8_TABLE(0x00711, 0x00711, 0), UTF8_TABLE(0x00730, 0x0074a, 0),
+    UTF8_TABLE(0x007a6, 0x007b0, 0), UTF8_TABLE(0x007eb, 0x007f3, 0),
+    UTF8_TABLE(0x00816, 0x00819, 0), UTF8_TABLE(0x0081b, 0x00823, 0),
+    UTF8_TABLE(0x00825, 0x00827, 0), UTF8_TABLE(0x00829, 0x0082d, 0),
+    UTF8_TABLE(0x00859, 0x0085b, 0), UTF8_TABLE(0x008d3, 0x008e1, 0),
+    UTF8_TABLE(0x008e3, 0x00902, 0), UTF8_TABLE(0x0093a, 0x0093a, 0),
+    UTF8_TABLE(0x0093c, 0x0093c, 0), UTF8_TABLE(0x00941, 0x00948, 0),
+    UTF8_TABLE(0x0094d, 0x0094d, 0), UTF8_TABLE(0x00951, 0x00957, 0),
+    UTF8_TABLE(0x00962, 0x00963, 0), UTF8_TABLE(0x00981, 0x00981, 0),
+    UTF8_TABLE(0x009bc, 0x009bc, 0), UTF8_TABLE(0x009c1, 0x009c4, 0),
+    UTF8_TABLE(0x009cd, 0x009cd, 0), UTF8_TABLE(0x009e2, 0x009e3, 0),
+    UTF8_TABLE(0x00a01, 0x00a02, 0), UTF8_TABLE(0x00a3c, 0x00a3c, 0),
+    UTF8_TABLE(0x00a41, 0x00a42, 0), UTF8_TABLE(0x00a47, 0x00a48, 0),
+    UTF8_TABLE(0x00a4b, 0x00a4d, 0), UTF8_TABLE(0x00a70, 0x00a71, 0),
+    UTF8_TABLE(0x00a81, 0x00a82, 0), UTF8_TABLE(0x00abc, 0x00abc, 0),
+    UTF8_TABLE(0x00ac1, 0x00ac5, 0), UTF8_TABLE(0x00ac7, 0x00ac8, 0),
+    UTF8_TABLE(0x00acd, 0x00acd, 0), UTF8_TABLE(0x00b01, 0x00b01, 0),
+    UTF8_TABLE(0x00b3c, 0x00b3c, 0), UTF8_TABLE(0x00b3f, 0x00b3f, 0),
+    UTF8_TABLE(0x00b41, 0x00b44, 0), UTF8_TABLE(0x00b4d, 0x00b4d, 0),
+    UTF8_TABLE(0x00bc0, 0x00bc0, 0), UTF8_TABLE(0x00bcd, 0x00bcd, 0),
+    UTF8_TABLE(0x00c3e, 0x00c40, 0), UTF8_TABLE(0x00c46, 0x00c48, 0),
+    UTF8_TABLE(0x00c4a, 0x00c4d, 0), UTF8_TABLE(0x00cbc, 0x00cbc, 0),
+    UTF8_TABLE(0x00ccc, 0x00ccd, 0), UTF8_TABLE(0x00d41, 0x00d44, 0),
+    UTF8_TABLE(0x00d4d, 0x00d4d, 0), UTF8_TABLE(0x00dca, 0x00dca, 0),
+    UTF8_TABLE(0x00dd2, 0x00dd4, 0), UTF8_TABLE(0x00dd6, 0x00dd6, 0),
+    UTF8_TABLE(0x00e31, 0x00e31, 0), UTF8_TABLE(0x00e34, 0x00e3a, 0),
+    UTF8_TABLE(0x00e47, 0x00e4e, 0), UTF8_TABLE(0x00eb1, 0x00eb1, 0),
+    UTF8_TABLE(0x00eb4, 0x00ebc, 0), UTF8_TABLE(0x00ec8, 0x00ecd, 0),
+    UTF8_TABLE(0x00f18, 0x00f19, 0), UTF8_TABLE(0x00f35, 0x00f35, 0),
+    UTF8_TABLE(0x00f37, 0x00f37, 0), UTF8_TABLE(0x00f39, 0x00f39, 0),
+    UTF8_TABLE(0x00f71, 0x00f7e, 0), UTF8_TABLE(0x00f80, 0x00f84, 0),
+    UTF8_TABLE(0x00f86, 0x00f87, 0), UTF8_TABLE(0x00f8d, 0x00fbc, 0),
+    UTF8_TABLE(0x00fc6, 0x00fc6, 0), UTF8_TABLE(0x0102d, 0x01030, 0),
+    UTF8_TABLE(0x01032, 0x01037, 0), UTF8_TABLE(0x01039, 0x0103a, 0),
+    UTF8_TABLE(0x0103d, 0x0103e, 0), UTF8_TABLE(0x01058, 0x01059, 0),
+    UTF8_TABLE(0x01100, 0x0115f, 2), UTF8_TABLE(0x01160, 0x011ff, 0),
+    UTF8_TABLE(0x0135d, 0x0135f, 0), UTF8_TABLE(0x01712, 0x01714, 0),
+    UTF8_TABLE(0x017b4, 0x017b5, 0), UTF8_TABLE(0x017b7, 0x017bd, 0),
+    UTF8_TABLE(0x017c6, 0x017c6, 0), UTF8_TABLE(0x017c9, 0x017d3, 0),
+    UTF8_TABLE(0x017dd, 0x017dd, 0), UTF8_TABLE(0x0180b, 0x0180f, 0),
+    UTF8_TABLE(0x018a9, 0x018a9, 0), UTF8_TABLE(0x01920, 0x01922, 0),
+    UTF8_TABLE(0x01a17, 0x01a18, 0), UTF8_TABLE(0x01ab0, 0x01aff, 0),
+    UTF8_TABLE(0x01b00, 0x01b03, 0), UTF8_TABLE(0x01b34, 0x01b34, 0),
+    UTF8_TABLE(0x01b36, 0x01b3a, 0), UTF8_TABLE(0x01dc0, 0x01dff, 0),
+    UTF8_TABLE(0x0200b, 0x0200f, 0), UTF8_TABLE(0x0202a, 0x0202e, 0),
+    UTF8_TABLE(0x02060, 0x02064, 0), UTF8_TABLE(0x020d0, 0x020f0, 0),
+    UTF8_TABLE(0x0231a, 0x0231b, 2), UTF8_TABLE(0x02329, 0x0232a, 2),
+    UTF8_TABLE(0x023e9, 0x023ec, 2), UTF8_TABLE(0x023f0, 0x023f0, 2),
+    UTF8_TABLE(0x023f3, 0x023f3, 2), UTF8_TABLE(0x025fd, 0x025fe, 2),
+    UTF8_TABLE(0x02614, 0x02615, 2), UTF8_TABLE(0x02648, 0x02653, 2),
+    UTF8_TABLE(0x0267f, 0x0267f, 2), UTF8_TABLE(0x02693, 0x02693, 2),
+    UTF8_TABLE(0x026a1, 0x026a1, 2), UTF8_TABLE(0x026aa, 0x026ab, 2),
+    UTF8_TABLE(0x026bd, 0x026be, 2), UTF8_TABLE(0x026c4, 0x026c5, 2),
+    UTF8_TABLE(0x026ce, 0x026ce, 2), UTF8_TABLE(0x026d4, 0x026d4, 2),
+    UTF8_TABLE(0x026ea, 0x026ea, 2), UTF8_TABLE(0x026f2, 0x026f3, 2),
+    UTF8_TABLE(0x026f5, 0x026f5, 2), UTF8_TABLE(0x026fa, 0x026fa, 2),
+    UTF8_TABLE(0x026fd, 0x026fd, 2), UTF8_TABLE(0x02705, 0x02705, 2),
+    UTF8_TABLE(0x0270a, 0x0270b, 2), UTF8_TABLE(0x02728, 0x02728, 2),
+    UTF8_TABLE(0x0274c, 0x0274c, 2), UTF8_TABLE(0x0274e, 0x0274e, 2),
+    UTF8_TABLE(0x02753, 0x02755, 2), UTF8_TABLE(0x02757, 0x02757, 2),
+    UTF8_TABLE(0x02795, 0x02797, 2), UTF8_TABLE(0x027b0, 0x027b0, 2),
+    UTF8_TABLE(0x027bf, 0x027bf, 2), UTF8_TABLE(0x02b1b, 0x02b1c, 2),
+    UTF8_TABLE(0x02b50, 0x02b50, 2), UTF8_TABLE(0x02b55, 0x02b55, 2),
+    UTF8_TABLE(0x02cef, 0x02cf1, 0), UTF8_TABLE(0x02de0, 0x02dff, 0),
+    UTF8_TABLE(0x02e80, 0x03029, 2), UTF8_TABLE(0x0302a, 0x0302d, 0),
+    UTF8_TABLE(0x0302e, 0x03098, 2), UTF8_TABLE(0x03099, 0x0309a, 0),
+    UTF8_TABLE(0x0309b, 0x0a4cf, 2), UTF8_TABLE(0x0a66f, 0x0a672, 0),
+    UTF8_TABLE(0x0a674, 0x0a67d, 0), UTF8_TABLE(0x0a69e, 0x0a69f, 0),
+    UTF8_TABLE(0x0a6f0, 0x0a6f1, 0), UTF8_TABLE(0x0a8c4, 0x0a8c5, 0),
+    UTF8_TABLE(0x0a8e0, 0x0a8f1, 0), UTF8_TABLE(0x0a960, 0x0a97f, 2),
+    UTF8_TABLE(0x0ac00, 0x0d7a3, 2), UTF8_TABLE(0x0f900, 0x0faff, 2),
+    UTF8_TABLE(0x0fe00, 0x0fe0f, 0), UTF8_TABLE(0x0fe10, 0x0fe19, 2),
+    UTF8_TABLE(0x0fe20, 0x0fe2f, 0), UTF8_TABLE(0x0fe30, 0x0fe6f, 2),
+    UTF8_TABLE(0x0feff, 0x0feff, 0), UTF8_TABLE(0x0ff00, 0x0ff60, 2),
+    UTF8_TABLE(0x0ffe0, 0x0ffe6, 2), UTF8_TABLE(0x16fe0, 0x16fe4, 2),
+    UTF8_TABLE(0x17000, 0x18aff, 2), UTF8_TABLE(0x1b000, 0x1b2ff, 2),
+    UTF8_TABLE(0x1d167, 0x1d169, 0), UTF8_TABLE(0x1d173, 0x1d182, 0),
+    UTF8_TABLE(0x1f004, 0x1f004, 2), UTF8_TABLE(0x1f0cf, 0x1f0cf, 2),
+    UTF8_TABLE(0x1f18e, 0x1f18e, 2), UTF8_TABLE(0x1f191, 0x1f19a, 2),
+    UTF8_TABLE(0x1f200, 0x1f202, 2), UTF8_TABLE(0x1f210, 0x1f23b, 2),
+    UTF8_TABLE(0x1f240, 0x1f248, 2), UTF8_TABLE(0x1f250, 0x1f251, 2),
+    UTF8_TABLE(0x1f260, 0x1f265, 2), UTF8_TABLE(0x1f300, 0x1f320, 2),
+    UTF8_TABLE(0x1f32d, 0x1f335, 2), UTF8_TABLE(0x1f337, 0x1f37c, 2),
+    UTF8_TABLE(0x1f37e, 0x1f393, 2), UTF8_TABLE(0x1f3a0, 0x1f3ca, 2),
+    UTF8_TABLE(0x1f3cf, 0x1f3d3, 2), UTF8_TABLE(0x1f3e0, 0x1f3f0, 2),
+    UTF8_TABLE(0x1f3f4, 0x1f3f4, 2), UTF8_TABLE(0x1f3f8, 0x1f43e, 2),
+    UTF8_TABLE(0x1f440, 0x1f440, 2), UTF8_TABLE(0x1f442, 0x1f4fc, 2),
+    UTF8_TABLE(0x1f4ff, 0x1f53d, 2), UTF8_TABLE(0x1f54b, 0x1f54e, 2),
+    UTF8_TABLE(0x1f550, 0x1f567, 2), UTF8_TABLE(0x1f57a, 0x1f57a, 2),
+    UTF8_TABLE(0x1f595, 0x1f596, 2), UTF8_TABLE(0x1f5a4, 0x1f5a4, 2),
+    UTF8_TABLE(0x1f5fb, 0x1f64f, 2), UTF8_TABLE(0x1f680, 0x1f6c5, 2),
+    UTF8_TABLE(0x1f6cc, 0x1f6cc, 2), UTF8_TABLE(0x1f6d0, 0x1f6d2, 2),
+    UTF8_TABLE(0x1f6d5, 0x1f6d7, 2), UTF8_TABLE(0x1f6eb, 0x1f6ec, 2),
+    UTF8_TABLE(0x1f6f4, 0x1f6fc, 2), UTF8_TABLE(0x1f7e0, 0x1f7eb, 2),
+    UTF8_TABLE(0x1f90c, 0x1f93a, 2), UTF8_TABLE(0x1f93c, 0x1f945, 2),
+    UTF8_TABLE(0x1f947, 0x1f9ff, 2), UTF8_TABLE(0x1fa70, 0x1faff, 2),
+    UTF8_TABLE(0x20000, 0x2fffd, 2), UTF8_TABLE(0x30000, 0x3fffd, 2),
+    UTF8_TABLE(0xe0001, 0xe0001, 0), UTF8_TABLE(0xe0020, 0xe007f, 0),
+    UTF8_TABLE(0xe0100, 0xe01ef, 0),
+};
+
+static unsigned int
+utf8_wcwidth(unsigned int code)
+{
+    unsigned int min, max, mid;
+
+    if (code < utf8_table[0].first)
+        return 1;
+
+    min = 0;
+    max = BFDEV_ARRAY_SIZE(utf8_table);
+
+    while (min < max) {
+        mid = (min + max) / 2;
+        if (code < utf8_table[mid].first)
+            max = mid;
+        else if (code > utf8_table[mid].last)
+            min = mid + 1;
+        else
+            return utf8_table[mid].width;
+    }
+
+    return 1;
+}
+
+static inline bool
+utf8_isprint(unsigned int code)
+{
+    if (code < 0x80)
+        return isprint(code);
+
+    /* C1 control characters */
+    return code > 0x9f && code <= UTF8_MAX;
+}
+
+static unsigned int
+utf8_encode(unsigned int code, char *utf8)
+{
+    if (code < 0x80) {
+        utf8[0] = code;
+        return 1;
+    }
+
+    if (code < 0x800) {
+        utf8[0] = 0xc0 | (code >> 6);
+        utf8[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+
+    if (code < 0x10000) {
+        utf8[0] = 0xe0 | (code >> 12);
+        utf8[1] = 0x80 | ((code >> 6) & 0x3f);
+        utf8[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+
+    utf8[0] = 0xf0 | (code >> 18);
+    utf8[1] = 0x80 | ((code >> 12) & 0x3f);
+    utf8[2] = 0x80 | ((code >> 6) & 0x3f);
+    utf8[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+/*
+ * Decode one codepoint from @str. Malformed input is consumed one
+ * byte at a time and reported as a one column wide character, so the
+ * column math stays in step with what the terminal will show.
+ */
+static unsigned int
+utf8_decode(const char *str, unsigned int len, unsigned int *code)
+{
+    const unsigned char *ustr = (const unsigned char *)str;
+    unsigned int count, index, value;
+
+    value = *ustr;
+    if (value < 0x80) {
+        *code = value;
+        return 1;
+    }
+
+    /* 0xf5 and up would encode past U+10FFFF */
+    if (value >= 0xf5)
+        goto invalid;
+
+    if (value >= 0xf0) {
+        count = 4;
+        value &= 0x07;
+    } else if (value >= 0xe0) {
+        count = 3;
+        value &= 0x0f;
+    } else if (value >= 0xc2) {
+        count = 2;
+        value &= 0x1f;
+    } else
+        goto invalid;
+
+    if (count > len)
+        goto invalid;
+
+    for (index = 1; index < count; ++index) {
+        if ((ustr[index] & 0xc0) != 0x80)
+            goto invalid;
+        value = (value << 6) | (ustr[index] & 0x3f);
+    }
+
+    if ((count == 3 && value < 0x800) ||
+        (count == 4 && (value < 0x10000 || value > UTF8_MAX)) ||
+        (value >= 0xd800 && value <= 0xdfff))
+        goto invalid;
+
+    *code = value;
+    return count;
+
+invalid:
+    *code = '?';
+    return 1;
+}
+
+/*
+ * Length of the leading pure-ASCII run of @str. Long lines and pastes
+ * are almost entirely ASCII, so this is where width scanning spends
+ * its time; it is done a vector (or a machine word) at a time.
+ */
+static unsigned int
+utf8_ascii(const char *str, unsigned int len)
+{
+    unsigned int index = 0;
+    uint64_t word;
+
+#if defined(__AVX2__)
+    for (; index + 32 <= len; index += 32) {
+        __m256i vect = _mm256_loadu_si256((const __m256i *)(str + index));
+        unsigned int mask = _mm256_movemask_epi8(vect);
+        if (mask)
+            return index + __builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; index + 16 <= len; index += 16) {
+        __m128i vect = _mm_loadu_si128((const __m128i *)(str + index));
+        unsigned int mask = _mm_movemask_epi8(vect);
+        if (mask)
+            return index + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; index + 8 <= len; index += 8) {
+        memcpy(&word, str + index, sizeof(word));
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+
+    for (; index < len; ++index) {
+        if (str[index] & 0x80)
+            break;
+    }
+
+    return index;
+}
+
+static unsigned int
+utf8_width(const char *str, unsigned int len)
+{
+    unsigned int width, step, code;
+
+    for (width = 0; len; len -= step, str += step) {
+        step = utf8_ascii(str, len);
+        width += step;
+        if (step)
+            continue;
+
+        step = utf8_decode(str, len, &code);
+        width += utf8_wcwidth(code);
+    }
+
+    return width;
+}
+
+/*
+ * Character boundaries. A character is one codepoint together with
+ * any zero width codepoints combining onto it.
+ */
+static unsigned int
+utf8_next(const char *str, unsigned int len, unsigned int pos)
+{
+    unsigned int code;
+
+    if (pos >= len)
+        return len;
+
+    pos += utf8_decode(str + pos, len - pos, &code);
+    while (pos < len && (str[pos] & 0x80)) {
+        unsigned int step;
+
+        step = utf8_decode(str + pos, len - pos, &code);
+        if (utf8_wcwidth(code))
+            break;
+        pos += step;
+    }
+
+    return pos;
+}
+
+static unsigned int
+utf8_prev(const char *str, unsigned int pos)
+{
+    unsigned int code, prev;
+
+    while (pos) {
+        prev = pos - 1;
+        while (prev && pos - prev < 4 &&
+               ((unsigned char)str[prev] & 0xc0) == 0x80)
+            --prev;
+
+        if (utf8_decode(str + prev, pos - prev, &code) != pos - prev)
+            prev = pos - 1;
+
+        pos = prev;
+        if (code < 0x80 || utf8_wcwidth(code))
+            break;
+    }
+
+    return pos;
+}
+
+#endif /* _BFRL_READLINE_ */
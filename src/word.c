@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2023 John Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifdef _BFRL_READLINE_
+
+/*
+ * Word characters are alphanumerics, every byte of a multibyte
+ * character and the extra ASCII characters of bfrl_wordchars_set.
+ * The bitmap classifies a byte at a time, the vector kernels test
+ * the same set by ranges plus one compare per extra character.
+ */
+static inline bool
+word_test(struct bfrl_state *rstate, char ch)
+{
+    unsigned char value = ch;
+
+    return rstate->wordmap[value >> 3] & (1U << (value & 7));
+}
+
+static int
+word_setup(struct bfrl_state *rstate, const char *chars)
+{
+    unsigned int value, count;
+    const char *walk;
+
+    for (count = 0, walk = chars; walk && *walk; ++walk) {
+        value = (unsigned char)*walk;
+        if (value < 0x80 && !isalnum(value) &&
+            !memchr(chars, value, walk - chars))
+            ++count;
+    }
+
+    if (count > BFRL_WORDCHARS_MAX)
+        return -BFDEV_EOVERFLOW;
+
+    memset(rstate->wordmap, 0, sizeof(rstate->wordmap));
+    for (value = 0; value < 256; ++value) {
+        if (value >= 0x80 || isalnum(value))
+            rstate->wordmap[value >> 3] |= 1U << (value & 7);
+    }
+
+    rstate->nwordchars = 0;
+    for (walk = chars; walk && *walk; ++walk) {
+        if (word_test(rstate, *walk))
+            continue;
+
+        value = (unsigned char)*walk;
+        rstate->wordmap[value >> 3] |= 1U << (value & 7);
+        rstate->wordchars[rstate->nwordchars++] = *walk;
+    }
+
+    return -BFDEV_ENOERR;
+}
+
+#if defined(__AVX2__)
+static inline unsigned int
+word_mask256(struct bfrl_state *rstate, const char *str)
+{
+    __m256i vect, match, digit, alpha;
+    unsigned int index;
+
+    vect = _mm256_loadu_si256((const __m256i *)str);
+
+    /* Unsigned range checks as biased signed compares */
+    match = _mm256_cmpgt_epi8(_mm256_setzero_si256(), vect);
+    digit = _mm256_sub_epi8(vect, _mm256_set1_epi8((char)('0' + 0x80)));
+    digit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 10)), digit);
+    alpha = _mm256_or_si256(vect, _mm256_set1_epi8(0x20));
+    alpha = _mm256_sub_epi8(alpha, _mm256_set1_epi8((char)('a' + 0x80)));
+    alpha = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 26)), alpha);
+    match = _mm256_or_si256(match, _mm256_or_si256(digit, alpha));
+
+    for (index = 0; index < rstate->nwordchars; ++index) {
+        digit = _mm256_set1_epi8(rstate->wordchars[index]);
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(vect, digit));
+    }
+
+    return _mm256_movemask_epi8(match);
+}
+#endif
+
+#if defined(__SSE2__)
+static inline unsigned int
+word_mask128(struct bfrl_state *rstate, const char *str)
+{
+    __m128i vect, match, digit, alpha;
+    unsigned int index;
+
+    vect = _mm_loadu_si128((const __m128i *)str);
+
+    match = _mm_cmplt_epi8(vect, _mm_setzero_si128());
+    digit = _mm_sub_epi8(vect, _mm_set1_epi8((char)('0' + 0x80)));
+    digit = _mm_cmplt_epi8(digit, _mm_set1_epi8((char)(0x80 + 10)));
+    alpha = _mm_or_si128(vect, _mm_set1_epi8(0x20));
+    alpha = _mm_sub_epi8(alpha, _mm_set1_epi8((char)('a' + 0x80)));
+    alpha = _mm_cmplt_epi8(alpha, _mm_set1_epi8((char)(0x80 + 26)));
+    match = _mm_or_si128(match, _mm_or_si128(digit, alpha));
+
+    for (index = 0; index < rstate->nwordchars; ++index) {
+        digit = _mm_set1_epi8(rstate->wordchars[index]);
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(vect, digit));
+    }
+
+    return _mm_movemask_epi8(match);
+}
+#endif
+
+/* Length of the leading run of @str that is (not) made of word characters */
+static unsigned int
+word_span(struct bfrl_state *rstate, const char *str,
+          unsigned int len, bool word)
+{
+    unsigned int index = 0, mask;
+
+#if defined(__AVX2__)
+    for (; index + 32 <= len; index += 32) {
+        mask = word_mask256(rstate, str + index) ^ (word ? ~0U : 0);
+        if (mask)
+            return index + __builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; index + 16 <= len; index += 16) {
+        mask = word_mask128(rstate, str + index) ^ (word ? 0xffff : 0);
+        if (mask)
+            return index + __builtin_ctz(mask);
+    }
+#endif
+
+    while (index < len && word_test(rstate, str[index]) == word)
+        ++index;
+
+    return index;
+}
+
+/* Length of the trailing run of @str that is (not) made of word characters */
+static unsigned int
+word_rspan(struct bfrl_state *rstate, const char *str,
+           unsigned int len, bool word)
+{
+    unsigned int index = 0, mask;
+
+#if defined(__AVX2__)
+    for (; index + 32 <= len; index += 32) {
+        mask = word_mask256(rstate, str + len - index - 32) ^ (word ? ~0U : 0);
+        if (mask)
+            return index + __builtin_clz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; index + 16 <= len; index += 16) {
+        mask = word_mask128(rstate, str + len - index - 16) ^ (word ? 0xffff : 0);
+        if (mask)
+            return index + __builtin_clz(mask) - 16;
+    }
+#endif
+
+    while (index < len && word_test(rstate, str[len - index - 1]) == word)
+        ++index;
+
+    return index;
+}
+
+/* Start of the next word behind @offset, or the buffer end */
+static unsigned int
+word_next(struct bfrl_state *rstate, unsigned int offset)
+{
+    offset += word_span(rstate, rstate->buff + offset, rstate->len - offset, true);
+    offset += word_span(rstate, rstate->buff + offset, rstate->len - offset, false);
+
+    return offset;
+}
+
+/* End of the word at or behind @offset, or the buffer end */
+static unsigned int
+word_end(struct bfrl_state *rstate, unsigned int offset)
+{
+    offset += word_span(rstate, rstate->buff + offset, rstate->len - offset, false);
+    offset += word_span(rstate, rstate->buff + offset, rstate->len - offset, true);
+
+    return offset;
+}
+
+/* Start of the word in front of @offset, or the buffer start */
+static unsigned int
+word_prev(struct bfrl_state *rstate, unsigned int offset)
+{
+    offset -= word_rspan(rstate, rstate->buff, offset, false);
+    offset -= word_rspan(rstate, rstate->buff, offset, true);
+
+    return offset;
+}
+
+#endif /* _BFRL_READLINE_ */